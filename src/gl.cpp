@@ -3,14 +3,20 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
+#include <cassert>
+#include <numeric>
 #include <fstream>
 #include <sstream>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <string>
+#include <cstring>
 #include <vector>
 #define LIGHTMAPPER_IMPLEMENTATION
 #include "lightmapper.h"
+#include "indices.h"
+#include "parallel.h"
 
 void Camera::update(MouseState mouse) {
     if (mouse.leftButtonDown) {
@@ -55,9 +61,16 @@ GLuint compileShader(GLenum type, const std::string& source) {
     return shader;
 }
 
-GLuint createShaderProgram(const char* vertexPath, const char* fragmentPath) {
-    std::string vertexSource = readShaderFile(vertexPath);
-    std::string fragmentSource = readShaderFile(fragmentPath);
+// Helper function to insert defines after the #version line of a shader
+static std::string insertDefines(std::string source, const std::string& defines) {
+    size_t lineEnd = source.find('\n');
+    if (lineEnd == std::string::npos) return source + "\n" + defines;
+    return source.insert(lineEnd + 1, defines);
+}
+
+GLuint createShaderProgram(const char* vertexPath, const char* fragmentPath, const std::string& defines) {
+    std::string vertexSource = insertDefines(readShaderFile(vertexPath), defines);
+    std::string fragmentSource = insertDefines(readShaderFile(fragmentPath), defines);
 
     GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
     GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
@@ -78,9 +91,81 @@ GLuint createShaderProgram(const char* vertexPath, const char* fragmentPath) {
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
 
+    // Connect the shared uniform blocks, if used
+    GLuint transformBlock = glGetUniformBlockIndex(shaderProgram, "Transforms");
+    if (transformBlock != GL_INVALID_INDEX) {
+        glUniformBlockBinding(shaderProgram, transformBlock, TRANSFORM_BLOCK_BINDING);
+    }
+    GLuint parameterBlock = glGetUniformBlockIndex(shaderProgram, "Parameters");
+    if (parameterBlock != GL_INVALID_INDEX) {
+        glUniformBlockBinding(shaderProgram, parameterBlock, PARAMETER_BLOCK_BINDING);
+    }
+
+    // Samplers always read the same texture units
+    glUseProgram(shaderProgram);
+    glUniform1i(glGetUniformLocation(shaderProgram, "lightmap"), LIGHTMAP_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(shaderProgram, "chunkBounds"), BUFFER_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(shaderProgram, "atoms"), BUFFER_TEXTURE_UNIT);
+    glUseProgram(0);
+
     return shaderProgram;
 }
 
+GLuint createTransformFeedbackProgram(const char* vertexPath, const std::vector<const char*>& varyings) {
+    std::string vertexSource = readShaderFile(vertexPath);
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+
+    GLuint shaderProgram = glCreateProgram();
+    glAttachShader(shaderProgram, vertexShader);
+    // Varyings must be set before linking
+    glTransformFeedbackVaryings(shaderProgram, varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(shaderProgram);
+
+    GLint success;
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    if (!success) {
+        GLchar infoLog[512];
+        glGetProgramInfoLog(shaderProgram, 512, nullptr, infoLog);
+        std::cerr << "Shader program linking failed: " << infoLog << std::endl;
+    }
+
+    glDeleteShader(vertexShader);
+
+    return shaderProgram;
+}
+
+Shaders::Shaders() {
+    for (int packed = 0; packed < 2; packed++) {
+        std::string defines = "#define PACKED_VERTICES " + std::to_string(packed) + "\n";
+        meshWireframePrograms[packed] = createShaderProgram(
+                "../src/shaders/mesh_vertex.glsl",
+                "../src/shaders/wireframe_fragment.glsl",
+                defines
+                );
+        meshPrograms[packed] = createShaderProgram(
+                "../src/shaders/mesh_vertex.glsl",
+                "../src/shaders/mesh_fragment.glsl",
+                defines
+                );
+    }
+    for (int mode = 0; mode < 3; mode++) {
+        for (int cutPlanes = 0; cutPlanes < 2; cutPlanes++) {
+            std::string defines = "#define CYLINDER_MODE " + std::to_string(mode) + "\n"
+                                  "#define CUT_PLANES " + std::to_string(cutPlanes) + "\n";
+            cylinderWireframePrograms[mode][cutPlanes] = createShaderProgram(
+                    "../src/shaders/cylinder_vertex.glsl",
+                    "../src/shaders/wireframe_fragment.glsl",
+                    defines
+                    );
+            cylinderPrograms[mode][cutPlanes] = createShaderProgram(
+                    "../src/shaders/cylinder_vertex.glsl",
+                    "../src/shaders/cylinder_fragment.glsl",
+                    defines
+                    );
+        }
+    }
+}
+
 void Uniforms::updateMatrices(GLFWwindow *window, Camera &camera) {
     // Create projection matrix
     int w, h;
@@ -101,49 +186,157 @@ void Uniforms::updateMatrices(GLFWwindow *window, Camera &camera) {
 
     // Precompute light position in view space
     lightPos = view * glm::vec4(2.0f, 3.0f, 9.0f, 1.0f);
-}
 
-// Helper functions
-void setUniform(GLuint shaderProgram, const char name[], const glm::mat4& v) {
-    GLint loc = glGetUniformLocation(shaderProgram, name);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(v));
-}
-void setUniform(GLuint shaderProgram, const char name[], const glm::vec3& v) {
-    GLint loc = glGetUniformLocation(shaderProgram, name);
-    glUniform3fv(loc, 1, glm::value_ptr(v));
+    updateTransforms();
 }
-void setUniform(GLuint shaderProgram, const char name[], float v) {
-    GLint loc = glGetUniformLocation(shaderProgram, name);
-    glUniform1f(loc, v);
+
+// Uniform buffer that all programs share through one binding point. It is only written when its contents change.
+struct SharedUniformBuffer {
+    GLuint binding;
+    GLuint buffer = 0;
+    std::vector<unsigned char> contents;
+
+    void upload(const void *data, size_t size) {
+        if (buffer != 0 && contents.size() == size && std::memcmp(contents.data(), data, size) == 0) return;
+        if (buffer == 0) {
+            glGenBuffers(1, &buffer);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+        contents.assign((const unsigned char*)data, (const unsigned char*)data + size);
+    }
+};
+static_assert(sizeof(ParameterBlock) == 64, "ParameterBlock must match the std140 layout of Parameters");
+static SharedUniformBuffer transformBuffer { TRANSFORM_BLOCK_BINDING };
+static SharedUniformBuffer parameterBuffer { PARAMETER_BLOCK_BINDING };
+
+void Uniforms::updateTransforms() {
+    TransformBlock transforms;
+    transforms.modelView = view * model;
+    transforms.projection = projection;
+    transforms.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(transforms.modelView))));
+    glm::vec3 viewUp = glm::transpose(glm::inverse(glm::mat3(view))) * glm::vec3(0.0f, 1.0f, 0.0f);
+    transforms.viewUp = glm::vec4(glm::normalize(viewUp), 0.0f);
+    transformBuffer.upload(&transforms, sizeof(TransformBlock));
 }
-void setUniform(GLuint shaderProgram, const char name[], int v) {
-    GLint loc = glGetUniformLocation(shaderProgram, name);
-    glUniform1i(loc, v);
+
+void Uniforms::uploadParameters() {
+    // Matrices are in the shared transforms, see updateTransforms
+    ParameterBlock parameters = {};
+    parameters.lightPos = lightPos;
+    parameters.lightIntensity = lightIntensity;
+    parameters.ambientLightIntensity = ambientLightIntensity;
+    parameters.sphereRadius = sphereRadius;
+    parameters.cylinderRadius = cylinderRadius;
+    parameters.pitch = pitch;
+    parameters.width = width;
+    parameters.drawNormals = drawNormals;
+    parameters.drawTexture = drawTexture;
+    parameters.checkerboard = checkerboard;
+    parameters.raytraced = raytraced;
+    parameterBuffer.upload(&parameters, sizeof(ParameterBlock));
 }
-void setUniform(GLuint shaderProgram, const char name[], bool v) {
-    GLint loc = glGetUniformLocation(shaderProgram, name);
-    glUniform1i(loc, v);
+
+Mesh::Mesh(std::vector<MeshVertex> vertices, std::vector<unsigned int> indices)
+    : Mesh(MeshData { std::move(vertices), std::move(indices), {}, {}, {} }) {}
+
+// Contiguous indices that are drawn as a whole, and the vertex that 16 bit indices are relative to
+struct IndexSegment {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    unsigned int baseVertex;
+};
+
+// Split the indices of a mesh into segments, in order. Seams replace the first or last ring of a level of a chunk,
+// so those rings are segments of their own.
+static std::vector<IndexSegment> meshIndexSegments(size_t indexCount, const std::vector<MeshRange>& lods, const std::vector<MeshChunk>& chunks) {
+    std::vector<IndexSegment> segments;
+    if (chunks.empty()) {
+        for (const MeshRange& range : lods) {
+            segments.push_back({ range.firstIndex, range.indexCount, 0 });
+        }
+        if (lods.empty()) {
+            segments.push_back({ 0, (unsigned int)indexCount, 0 });
+        }
+    }
+    for (const MeshChunk& chunk : chunks) {
+        unsigned int baseVertex = chunk.lods[0].firstVertex;
+        for (size_t level = 0; level < chunk.lods.size(); level++) {
+            const MeshRange& range = chunk.lods[level];
+            unsigned int ring = chunk.ringIndexCounts[level];
+            if (range.indexCount >= 2 * ring) {
+                segments.push_back({ range.firstIndex, ring, baseVertex });
+                if (range.indexCount > 2 * ring) {
+                    segments.push_back({ range.firstIndex + ring, range.indexCount - 2 * ring, baseVertex });
+                }
+                segments.push_back({ range.firstIndex + range.indexCount - ring, ring, baseVertex });
+            }
+            else if (range.indexCount > 0) {
+                segments.push_back({ range.firstIndex, range.indexCount, baseVertex });
+            }
+        }
+        for (const MeshRange& seam : chunk.seams) {
+            if (seam.indexCount > 0) segments.push_back({ seam.firstIndex, seam.indexCount, baseVertex });
+        }
+    }
+    std::sort(segments.begin(), segments.end(), [](const IndexSegment& a, const IndexSegment& b) { return a.firstIndex < b.firstIndex; });
+    return segments;
 }
 
-void Uniforms::setUniforms(GLuint shaderProgram) {
-    setUniform(shaderProgram, "model", model);
-    setUniform(shaderProgram, "view", view);
-    setUniform(shaderProgram, "projection", projection);
-    setUniform(shaderProgram, "lightPos", lightPos);
-    setUniform(shaderProgram, "drawNormals", drawNormals);
-    setUniform(shaderProgram, "drawTexture", drawTexture);
-    setUniform(shaderProgram, "checkerboard", checkerboard);
-    setUniform(shaderProgram, "lightIntensity", lightIntensity);
-    setUniform(shaderProgram, "ambientLightIntensity", ambientLightIntensity);
-    setUniform(shaderProgram, "sphereRadius", sphereRadius);
-    setUniform(shaderProgram, "raytraced", raytraced);
-    setUniform(shaderProgram, "cylinderRadius", cylinderRadius);
-    setUniform(shaderProgram, "cylinderMode", cylinderMode);
-    setUniform(shaderProgram, "pitch", pitch);
-    setUniform(shaderProgram, "width", width);
+VertexCacheStats optimizeMeshIndices(MeshData& data) {
+    std::vector<IndexSegment> segments = meshIndexSegments(data.indices.size(), data.lods, data.chunks);
+    std::vector<size_t> missesBefore(segments.size()), missesAfter(segments.size());
+    parallelFor(segments.size(), [&](int i) {
+        unsigned int *indices = &data.indices[segments[i].firstIndex];
+        missesBefore[i] = vertexCacheMisses(indices, segments[i].indexCount);
+        optimizeVertexCache(indices, segments[i].indexCount);
+        missesAfter[i] = vertexCacheMisses(indices, segments[i].indexCount);
+    });
+    float triangles = std::max(float(data.indices.size() / 3), 1.0f);
+    return { float(std::accumulate(missesBefore.begin(), missesBefore.end(), size_t(0))) / triangles,
+             float(std::accumulate(missesAfter.begin(), missesAfter.end(), size_t(0))) / triangles };
 }
 
-Mesh::Mesh(std::vector<MeshVertex> vertices, std::vector<unsigned int> indices) {
+Mesh::Mesh(MeshData data, MeshIndexMode indexMode, MeshVertexFormat vertexFormat) {
+    const std::vector<MeshVertex>& vertices = data.vertices;
+    const std::vector<unsigned int>& indices = data.indices;
+
+    // Use 16 bit indices if every chunk (or the whole mesh) has few enough vertices, keeping the largest for restarts
+    std::vector<IndexSegment> segments = meshIndexSegments(indices.size(), data.lods, data.chunks);
+    relativeIndices = !data.chunks.empty();
+    bool shortIndices = std::all_of(data.chunks.begin(), data.chunks.end(), [](const MeshChunk& chunk) {
+        return chunk.lods[0].vertexCount < 0xFFFF;
+    });
+    if (data.chunks.empty()) shortIndices = vertices.size() < 0xFFFF;
+    indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    restartIndex = shortIndices ? 0xFFFF : 0xFFFFFFFF;
+    primitive = (indexMode == MeshIndexMode::Strips) ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+
+    // Convert each segment, ending strips with a restart so that consecutive segments can be drawn together
+    std::vector<unsigned int> bufferIndices;
+    bufferIndices.reserve(indices.size());
+    for (const IndexSegment& segment : segments) {
+        segmentStarts.push_back(segment.firstIndex);
+        bufferSegmentStarts.push_back(bufferIndices.size());
+        const unsigned int *first = indices.data() + segment.firstIndex;
+        unsigned int baseVertex = relativeIndices ? segment.baseVertex : 0;
+        if (indexMode == MeshIndexMode::Strips) {
+            for (unsigned int index : triangleStrips(first, segment.indexCount, 0xFFFFFFFF)) {
+                bufferIndices.push_back((index == 0xFFFFFFFF) ? restartIndex : index - baseVertex);
+            }
+            bufferIndices.push_back(restartIndex);
+        }
+        else {
+            for (unsigned int i = 0; i < segment.indexCount; i++) {
+                bufferIndices.push_back(first[i] - baseVertex);
+            }
+        }
+    }
+    segmentStarts.push_back(indices.size());
+    bufferSegmentStarts.push_back(bufferIndices.size());
+
     // Create buffers
     GLuint vao, vbo, ibo;
     glGenVertexArrays(1, &vao);
@@ -151,313 +344,290 @@ Mesh::Mesh(std::vector<MeshVertex> vertices, std::vector<unsigned int> indices)
     glGenBuffers(1, &ibo);
     // Bind VAO first
     glBindVertexArray(vao);
-    // Bind and fill VBO
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(MeshVertex), vertices.data(), GL_STATIC_DRAW);
     // Bind and fill IBO
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
-    // TODO Note that vertex attributes should be changed here, or make it a function of Vertex
-    // Position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, position));
-    glEnableVertexAttribArray(0);
-    // Normal attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
-    glEnableVertexAttribArray(1);
-    // Texture coordinate attribute
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, texCoord));
-    glEnableVertexAttribArray(2);
+    if (shortIndices) {
+        std::vector<unsigned short> shortBufferIndices(bufferIndices.begin(), bufferIndices.end());
+        indexBufferSize = shortBufferIndices.size() * sizeof(unsigned short);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, shortBufferIndices.data(), GL_STATIC_DRAW);
+    }
+    else {
+        indexBufferSize = bufferIndices.size() * sizeof(unsigned int);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, bufferIndices.data(), GL_STATIC_DRAW);
+    }
 
     this->vao = vao;
     this->vbo = vbo;
     this->ibo = ibo;
-    this->vertices = vertices;
-    this->indices = indices;
-}
-
-Mesh createSplineMesh(BSpline& spline, int splineSamples = 50, int loopResolution = 8, float radius = 1.0f) {
-    float totalLength = spline.arcLength(1.0f);
-    //std::cout << "Spline length: " << totalLength << std::endl;
-
-    // Sample points along the spline
-    std::vector<glm::vec3> splinePoints;
-    std::vector<glm::vec3> tangents;
-    std::vector<glm::vec3> normals;
-    std::vector<glm::vec3> binormals;
-    for (int i = 0; i < splineSamples; i++) {
-        float targetLength = float(i) / float(splineSamples - 1) * totalLength;
-        float t = spline.parameterFromArcLength(targetLength, totalLength);
-        glm::vec3 point = spline.evaluate(t);
-        splinePoints.push_back(point);
-        glm::vec3 tangent = glm::normalize(spline.derivative(t));
-        tangents.push_back(tangent);
-        glm::vec3 normal = glm::normalize(spline.evaluateOrientation(t));
-        // TODO When spline binormals flip, mesh ends up with flipped normals
-        // TODO Points where normals flip need to be the same across LODs
-        //if (i > 0 && glm::dot(normal, normals.back()) < 0.0) {
-        //    normal *= -1.0f; // TODO
-        //    std::cout << "normal flipped" << std::endl;
-        //}
-        normals.push_back(normal);
-        glm::vec3 binormal = glm::normalize(glm::cross(tangent, normal));
-        //if (i > 0 && glm::dot(binormal, binormals.back()) < 0.0) {
-        //    binormal *= -1.0f; // TODO
-        //    std::cout << "binormal flipped" << std::endl;
-        //}
-        binormals.push_back(binormal);
-    }
-
-    // Create cross-section circles for each sample
-    std::vector<std::vector<glm::vec3>> rings(splineSamples);
-    for (int i = 0; i < splineSamples; i++) {
-        float t = float(i) / float(splineSamples - 1);
-        glm::vec3 center = splinePoints[i];
-        glm::vec3 tangent = tangents[i];
-        glm::vec3 normal = normals[i];
-        glm::vec3 binormal = binormals[i];
-        // Generate circle points using interpolated orientation
-        rings[i].resize(loopResolution);
-        for (int j = 0; j < loopResolution; j++) {
-            float angle = 2.0f * M_PI * float(j) / float(loopResolution);
-            float d = glm::sin(angle);
-            float n = glm::cos(angle);
-
-            // NOTE Capped circular
-            d = glm::clamp(d, -0.125f, 0.125f);
-            //n = glm::clamp(n, -0.125f, 0.125f);
-
-            // NOTE Oval
-            //d /= 5.0f;
-            //n /= 5.0f;
-            //if (n > 0.0f) n += 0.5f;
-            //else if (n < 0.0f) n -= 0.5f;
-            //float d = (j % (loopResolution / 2) == 0) ? 0.0f : 1.0f;
-            //float d = 1.0f;
-
-            // NOTE Rectangular with dull edge, even spacing
-            //int a = j % (loopResolution / 2);
-            //float d = (a == 0) ? 0.0f : 0.125f;
-            //float n = -((a / (loopResolution / 2.0f - 1.0f)) * 2.0f - 1.0f);
-            //if (j < loopResolution / 2) {
-            //}
-            //else {
-            //    d *= -1.0f;
-            //    n *= -1.0f;
-            //}
-
-            // TODO Arrows
-            if (i < float(2) / float(spline.getControlPoints().size()) * splineSamples) {
-                n *= 0.25f;
-            }
-            else if (i < float(12) / float(spline.getControlPoints().size()) * splineSamples) {
-                float l = 2.0f / spline.getControlPoints().size();
-                t = fmod(t, l);
-                float ar = 1.0f / spline.getControlPoints().size();
-                if (t > 2.0f * ar) {
-                    n *= 0.25f;
-                }
-                else if (t > ar) {
-                    n *= 0.5f;
-                }
-                else {
-                    n *= t / ar + 0.25f;
-                }
-            }
+    this->vertices = std::move(data.vertices);
+    this->indices = std::move(data.indices);
+    this->ranges = std::move(data.ranges);
+    this->lods = std::move(data.lods);
+    this->chunks = std::move(data.chunks);
+    chunkVisible.assign(chunks.size(), true);
+    chunkLods.assign(chunks.size(), 0);
+
+    // Fill VBO and set vertex attributes
+    setVertexFormat(vertexFormat);
+}
 
-            glm::vec3 offset = radius * (d * binormal + n * normal);
-            rings[i][j] = center + offset;
-        }
+// Octahedral encoding of a unit vector: project it onto the octahedron |x| + |y| + |z| = 1, and fold the lower half
+// over the upper one, so that the vector becomes a point in the square [-1, 1]^2
+static glm::vec2 octahedralEncode(glm::vec3 n) {
+    n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f) {
+        e = glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
     }
+    return e;
+}
 
-    // Generate triangles between consecutive rings
-    unsigned int totalVertices = splineSamples * (loopResolution + 1);
-    std::vector<MeshVertex> vertices(totalVertices);
-    std::vector<unsigned int> indices;
-    std::vector<float> distAroundRing(loopResolution + 1);
-    // Fill positions and texture coordinates
-    for (int i = 0; i < splineSamples; i++) {
-        // First vertex
-        int vertexIndex = (i * (loopResolution + 1));
-        int ringIndex = 0;
-        glm::vec3 pos = rings[i][ringIndex];
-        vertices[vertexIndex].position = pos;
-        glm::vec3 prevPos = pos;
-        distAroundRing[0] = 0.0f;
-        for (int j = 1; j <= loopResolution; j++) {
-            int vertexIndex = (i * (loopResolution + 1) + j);
-            int ringIndex = j % loopResolution;
-            // Position
-            glm::vec3 pos = rings[i][ringIndex];
-            vertices[vertexIndex].position = pos;
-            // Normal will be filled later at indices 3, 4, 5
-            distAroundRing[j] = distAroundRing[j - 1] + glm::distance(prevPos, pos);
-            prevPos = pos;
-        }
-        float totalDist = distAroundRing[loopResolution];
-        for (int j = 0; j <= loopResolution; j++) {
-            int vertexIndex = (i * (loopResolution + 1) + j);
-            // Texture coordinates
-            float u = float(i) / float(splineSamples - 1);
-            float v = distAroundRing[j] / totalDist;
-            u = 0.999f * u + 0.0005f;
-            v = 0.999f * v + 0.0005f;
-            vertices[vertexIndex].texCoord = glm::vec2(u, v);
-        }
+// Number of vertices per block of work when packing vertices in parallel
+const int PACK_BLOCK_VERTICES = 4096;
+
+static unsigned short packUnorm16(float v) {
+    return (unsigned short)std::round(glm::clamp(v, 0.0f, 1.0f) * 65535.0f);
+}
+
+static short packSnorm16(float v) {
+    return (short)std::round(glm::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+void Mesh::setVertexFormat(MeshVertexFormat format) {
+    vertexFormat = format;
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    for (GLuint attribute = 0; attribute < 6; attribute++) {
+        glDisableVertexAttribArray(attribute);
     }
-    // Calculate averaged normals for each vertex
-    std::vector<glm::vec3> vertexNormals(totalVertices, glm::vec3(0.0f));
-    std::vector<int> normalCounts(totalVertices, 0);
-    for (int i = 0; i < splineSamples - 1; i++) {
-        for (int j = 0; j < loopResolution; j++) {
-            // Vertex indices for the quad
-            unsigned int v0 = i * (loopResolution + 1) + j;
-            unsigned int v1 = i * (loopResolution + 1) + j + 1;
-            unsigned int v1Base = i * (loopResolution + 1) + (j + 1) % loopResolution;
-            unsigned int v2 = (i + 1) * (loopResolution + 1) + j;
-            unsigned int v3 = (i + 1) * (loopResolution + 1) + j + 1;
-            unsigned int v3Base = (i + 1) * (loopResolution + 1) + (j + 1) % loopResolution;
-
-            // Get vertex positions
-            glm::vec3 pos0 = rings[i][j];
-            glm::vec3 pos1 = rings[i][(j + 1) % loopResolution];
-            glm::vec3 pos2 = rings[i + 1][j];
-            glm::vec3 pos3 = rings[i + 1][(j + 1) % loopResolution];
-
-            // First triangle (v0, v1, v2)
-            glm::vec3 normal1 = glm::normalize(glm::cross(pos1 - pos0, pos2 - pos0));
-            indices.insert(indices.end(), {v0, v1, v2});
-
-            // Accumulate normal for each vertex of first triangle
-            vertexNormals[v0] += normal1;
-            vertexNormals[v1Base] += normal1;
-            vertexNormals[v2] += normal1;
-            normalCounts[v0]++;
-            normalCounts[v1Base]++;
-            normalCounts[v2]++;
-
-            // Second triangle (v1, v3, v2)
-            glm::vec3 normal2 = glm::normalize(glm::cross(pos3 - pos1, pos2 - pos1));
-            indices.insert(indices.end(), {v1, v3, v2});
-
-            // Accumulate normal for each vertex of second triangle
-            vertexNormals[v1Base] += normal2;
-            vertexNormals[v3Base] += normal2;
-            vertexNormals[v2] += normal2;
-            normalCounts[v1Base]++;
-            normalCounts[v3Base]++;
-            normalCounts[v2]++;
-        }
+
+    if (format == MeshVertexFormat::Full) {
+        vertexBufferSize = vertices.size() * sizeof(MeshVertex);
+        glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, vertices.data(), GL_STATIC_DRAW);
+        // TODO Note that vertex attributes should be changed here, or make it a function of Vertex
+        // Position attribute
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, position));
+        glEnableVertexAttribArray(0);
+        // Normal attribute
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
+        glEnableVertexAttribArray(1);
+        // Texture coordinate attribute
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, texCoord));
+        glEnableVertexAttribArray(2);
+        return;
     }
-    // Average the normals and store them in the vertices array
-    for (int i = 0; i < totalVertices; i++) {
-        int baseI = i;
-        if (i % (loopResolution + 1) == loopResolution) baseI -= loopResolution;
-        if (normalCounts[baseI] > 0) {
-            glm::vec3 avgNormal = glm::normalize(vertexNormals[baseI] / float(normalCounts[baseI]));
-            vertices[i].normal = avgNormal;
+
+    // Bounds of every chunk, and of the whole mesh for vertices outside chunks (or if there are too many chunks)
+    std::vector<glm::vec3> minima, maxima;
+    for (const MeshChunk& chunk : chunks) {
+        if (chunks.size() >= 0xFFFF) break;
+        minima.push_back(chunk.min);
+        maxima.push_back(chunk.max);
+    }
+    glm::vec3 meshMin = vertices.empty() ? glm::vec3(0.0f) : vertices[0].position;
+    glm::vec3 meshMax = meshMin;
+    for (const MeshVertex& vertex : vertices) {
+        meshMin = glm::min(meshMin, vertex.position);
+        meshMax = glm::max(meshMax, vertex.position);
+    }
+    unsigned short meshBounds = minima.size();
+    minima.push_back(meshMin);
+    maxima.push_back(meshMax);
+
+    // Vertices on the ring between two chunks belong to the later one
+    std::vector<unsigned short> vertexChunks(vertices.size(), meshBounds);
+    for (unsigned short c = 0; c < meshBounds; c++) {
+        const MeshRange& range = chunks[c].lods[0];
+        std::fill(vertexChunks.begin() + range.firstVertex, vertexChunks.begin() + range.firstVertex + range.vertexCount, c);
+    }
+
+    std::vector<PackedMeshVertex> packedVertices(vertices.size());
+    parallelFor((vertices.size() + PACK_BLOCK_VERTICES - 1) / PACK_BLOCK_VERTICES, [&](int block) {
+        size_t end = std::min(size_t(block + 1) * PACK_BLOCK_VERTICES, vertices.size());
+        for (size_t i = size_t(block) * PACK_BLOCK_VERTICES; i < end; i++) {
+            const MeshVertex& vertex = vertices[i];
+            unsigned short c = vertexChunks[i];
+            glm::vec3 extent = maxima[c] - minima[c];
+            PackedMeshVertex& packed = packedVertices[i];
+            for (int k = 0; k < 3; k++) {
+                packed.position[k] = packUnorm16((extent[k] > 0.0f) ? (vertex.position[k] - minima[c][k]) / extent[k] : 0.0f);
+            }
+            packed.chunk = c;
+            glm::vec2 normal = octahedralEncode(vertex.normal);
+            packed.normal[0] = packSnorm16(normal.x);
+            packed.normal[1] = packSnorm16(normal.y);
+            packed.texCoord[0] = packUnorm16(vertex.texCoord.x);
+            packed.texCoord[1] = packUnorm16(vertex.texCoord.y);
         }
+    });
+    vertexBufferSize = packedVertices.size() * sizeof(PackedMeshVertex);
+    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, packedVertices.data(), GL_STATIC_DRAW);
+    // Position and chunk attribute, decoded in the shader
+    glVertexAttribIPointer(3, 4, GL_UNSIGNED_SHORT, sizeof(PackedMeshVertex), (void*)offsetof(PackedMeshVertex, position));
+    glEnableVertexAttribArray(3);
+    // Normal attribute
+    glVertexAttribPointer(4, 2, GL_SHORT, GL_TRUE, sizeof(PackedMeshVertex), (void*)offsetof(PackedMeshVertex, normal));
+    glEnableVertexAttribArray(4);
+    // Texture coordinate attribute
+    glVertexAttribPointer(5, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedMeshVertex), (void*)offsetof(PackedMeshVertex, texCoord));
+    glEnableVertexAttribArray(5);
+
+    // Minimum and extent of each chunk, as consecutive texels
+    std::vector<glm::vec4> bounds;
+    for (size_t c = 0; c < minima.size(); c++) {
+        bounds.push_back(glm::vec4(minima[c], 0.0f));
+        bounds.push_back(glm::vec4(maxima[c] - minima[c], 0.0f));
+    }
+    if (chunkBoundsBuffer == 0) {
+        glGenBuffers(1, &chunkBoundsBuffer);
+        glGenTextures(1, &chunkBoundsTexture);
     }
+    glBindBuffer(GL_TEXTURE_BUFFER, chunkBoundsBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, bounds.size() * sizeof(glm::vec4), bounds.data(), GL_STATIC_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, chunkBoundsTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, chunkBoundsBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
 
-    return Mesh(vertices, indices);
+// Fraction by which the projected error of a coarser level must be below the target before a chunk switches to it
+const float LOD_HYSTERESIS = 0.25f;
+
+Mesh createSplineMesh(BSpline& spline, int splineSamples, int loopResolution, float radius, bool rotationMinimizingFrames) {
+    spline.updateCaches();
+    std::vector<float> targetLengths = uniformSampleLengths(spline, splineSamples);
+    SplineProfiles profiles(loopResolution, spline.spanCount());
+    return Mesh(buildSplineMeshData(spline, targetLengths, profiles, radius, rotationMinimizingFrames, MeshNormals::Averaged));
+}
+
+Mesh createAdaptiveSplineMesh(BSpline& spline, float maxDeviation, int loopResolution, float radius, bool rotationMinimizingFrames) {
+    spline.updateCaches();
+    std::vector<float> targetLengths = spline.adaptiveSampleLengths(maxDeviation, radius, rotationMinimizingFrames);
+    SplineProfiles profiles(loopResolution, spline.spanCount());
+    return Mesh(buildSplineMeshData(spline, targetLengths, profiles, radius, rotationMinimizingFrames, MeshNormals::Averaged));
 }
 
-Spheres::Spheres(std::vector<SphereVertex> vertices) {
+// Default profiles for every chain of a set
+std::vector<SplineProfiles> defaultProfiles(SplineSet& splines, int loopResolution) {
+    std::vector<SplineProfiles> profiles;
+    profiles.reserve(splines.chainCount());
+    for (int c = 0; c < splines.chainCount(); c++) {
+        profiles.emplace_back(loopResolution, splines.chain(c).spanCount());
+    }
+    return profiles;
+}
+
+Mesh createSplineMesh(SplineSet& splines, int samplesPerUnitLength, int loopResolution, float radius, bool rotationMinimizingFrames) {
+    splines.updateCaches();
+    std::vector<std::vector<float>> targetLengths(splines.chainCount());
+    parallelFor(splines.chainCount(), [&](int c) {
+        BSpline& spline = splines.chain(c);
+        // One sample per unit of distance at lowest LOD, same as for single splines
+        int splineSamples = std::max(int(spline.arcLength(1.0f)), 2) * samplesPerUnitLength;
+        targetLengths[c] = uniformSampleLengths(spline, splineSamples);
+    });
+    return Mesh(buildSplineMeshData(splines, targetLengths, defaultProfiles(splines, loopResolution), radius, rotationMinimizingFrames, MeshNormals::Averaged));
+}
+
+Mesh createAdaptiveSplineMesh(SplineSet& splines, float maxDeviation, int loopResolution, float radius, bool rotationMinimizingFrames) {
+    splines.updateCaches();
+    std::vector<std::vector<float>> targetLengths(splines.chainCount());
+    parallelFor(splines.chainCount(), [&](int c) {
+        targetLengths[c] = splines.chain(c).adaptiveSampleLengths(maxDeviation, radius, rotationMinimizingFrames);
+    });
+    return Mesh(buildSplineMeshData(splines, targetLengths, defaultProfiles(splines, loopResolution), radius, rotationMinimizingFrames, MeshNormals::Averaged));
+}
+
+Spheres::Spheres(std::vector<SphereInstance> instances, std::vector<unsigned int> colors) {
+    assert(instances.size() == colors.size());
     // Create buffers
-    GLuint vao, vbo;
+    GLuint vao, vbo, colorBuffer;
     glGenVertexArrays(1, &vao);
     glGenBuffers(1, &vbo);
+    glGenBuffers(1, &colorBuffer);
     // Bind VAO first
     glBindVertexArray(vao);
-    // Bind and fill VBO
+    // Bind and fill VBO. Every attribute advances once per instance, the vertex shader places the quad corners.
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(SphereInstance), instances.data(), GL_DYNAMIC_DRAW);
     // Position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SphereInstance), (void*)offsetof(SphereInstance, position));
     glEnableVertexAttribArray(0);
+    glVertexAttribDivisor(0, 1);
+    // Radius attribute
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(SphereInstance), (void*)offsetof(SphereInstance, radius));
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    // Colour attribute
+    glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+    glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(unsigned int), colors.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(unsigned int), (void*)0);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
 
     this->vao = vao;
     this->vbo = vbo;
-    this->vertices = vertices;
+    this->colorBuffer = colorBuffer;
+    this->instances = std::move(instances);
+    this->colors = std::move(colors);
 }
 
-// NOTE We have to upload the same vertex multiple times so the vertex shader can displace them and form a quad.
-//      Can't reuse the same vertex with indexed drawing because of the way gl_VertexID works.
-Spheres createSpheres(std::vector<glm::vec3> &points) {
-    // Create vertex data
-    std::vector<SphereVertex> vertices;
+void Spheres::update(const std::vector<SphereInstance>& instances) {
+    assert(instances.size() == this->instances.size());
+    this->instances = instances;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(SphereInstance), instances.data());
+}
+
+Spheres createSpheres(std::vector<glm::vec3> &points, float radius, glm::vec3 color) {
+    // Create instance data
+    std::vector<SphereInstance> instances;
     for (int i = 0; i < points.size(); i++) {
-        for (int j = 0; j < 6; j++) {
-            vertices.push_back(SphereVertex { points[i] });
-        }
+        instances.push_back(SphereInstance { points[i], radius });
     }
-    return Spheres(vertices);
+    glm::vec3 rgb = glm::round(glm::clamp(color, 0.0f, 1.0f) * 255.0f);
+    unsigned int packedColor = (unsigned int)rgb.x | ((unsigned int)rgb.y << 8) | ((unsigned int)rgb.z << 16) | (255u << 24);
+    return Spheres(instances, std::vector<unsigned int>(points.size(), packedColor));
 };
 
-Cylinders::Cylinders(std::vector<CylinderVertex> vertices) {
+Cylinders::Cylinders(std::vector<CylinderBond> bonds, GLuint atomBuffer) {
     // Create buffers
-    GLuint vao, vbo;
+    GLuint vao, vbo, atomTexture;
     glGenVertexArrays(1, &vao);
     glGenBuffers(1, &vbo);
     // Bind VAO first
     glBindVertexArray(vao);
-    // Bind and fill VBO
+    // Bind and fill VBO, with one bond per instance
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(CylinderVertex), vertices.data(), GL_STATIC_DRAW);
-    // A position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CylinderVertex), (void*)offsetof(CylinderVertex, aPos));
+    glBufferData(GL_ARRAY_BUFFER, bonds.size() * sizeof(CylinderBond), bonds.data(), GL_STATIC_DRAW);
+    // Atom indices attribute
+    glVertexAttribIPointer(0, 4, GL_INT, sizeof(CylinderBond), (void*)0);
     glEnableVertexAttribArray(0);
-    // B position plane normal attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(CylinderVertex), (void*)(offsetof(CylinderVertex, bPos)));
-    glEnableVertexAttribArray(1);
-    // A cut plane normal attribute
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(CylinderVertex), (void*)(offsetof(CylinderVertex, aCPN)));
-    glEnableVertexAttribArray(2);
-    // B cut plane normal attribute
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(CylinderVertex), (void*)(offsetof(CylinderVertex, bCPN)));
-    glEnableVertexAttribArray(3);
-    // Start dir attribute
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(CylinderVertex), (void*)(offsetof(CylinderVertex, startDir)));
-    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(0, 1);
+
+    // Atom positions and radii, one texel per atom
+    static_assert(sizeof(SphereInstance) == 4 * sizeof(float), "Atoms must be RGBA32F texels");
+    glGenTextures(1, &atomTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, atomTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, atomBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
 
     this->vao = vao;
     this->vbo = vbo;
-    this->vertices = vertices;
+    this->atomTexture = atomTexture;
+    this->bonds = std::move(bonds);
 }
 
 // TODO Varying cylinder width
-// TODO This and the cylinder shaders could be split and optimized for the simple cylinder or helix case.
-//      For example, helices do not form splines so they don't need cut planes.
-//      Then they also only need one cap quad because the other always faces away from the camera.
-Cylinders createCylinders(std::vector<glm::vec3> &points) {
-    // Create vertex data
-    std::vector<CylinderVertex> vertices;
-    for (int i = 0; i < points.size() - 1; i++) {
-        glm::vec3 a = points[i];
-        glm::vec3 b = points[i + 1];
-        // Calculate cut plane normals
-        glm::vec3 aCPN, bCPN;
-        if (i < 1) {
-            aCPN = glm::normalize(b - a);
-        }
-        else {
-            aCPN = glm::normalize(glm::normalize(b - a) - glm::normalize(points[i - 1] - a));
-        }
-        if (i > points.size() - 3) {
-            bCPN = glm::normalize(b - a);
-        }
-        else {
-            bCPN = glm::normalize(glm::normalize(points[i + 2] - b) - glm::normalize(a - b));
-        }
-        // TODO Compute meaningful value for startDir
-        //      It should be perpendicular to the cylinder axis!
-        //      Currently this will produce artifacts if a cylinder is pointing in the x direction
-        glm::vec3 startDir(1.0f, 0.0f, 0.0f);
-        CylinderVertex v { a, b, aCPN, bCPN, startDir };
-        for (int j = 0; j < 18; j++) {
-            vertices.push_back(v);
-        }
+Cylinders createCylinders(const Spheres& spheres) {
+    // Create bond data, the cut planes are computed in the vertex shader
+    int n = spheres.instances.size();
+    std::vector<CylinderBond> bonds;
+    for (int i = 0; i < n - 1; i++) {
+        bonds.push_back(CylinderBond { i - 1, i, i + 1, (i + 2 < n) ? i + 2 : -1 });
     }
-    return Cylinders(vertices);
+    return Cylinders(bonds, spheres.vbo);
 };
 
 // See https://github.com/ands/lightmapper
@@ -503,13 +673,14 @@ void bakeLightmap(GLuint *texture, Mesh &mesh, GLuint shaderProgram) {
         memset(data, 0.0f, sizeof(float) * w * h * 3);
         lmSetTargetLightmap(ctx, data, w, h, 4);
 
-        // Set mesh data
+        // Set mesh data, of the current level of detail only
+        MeshRange range = mesh.drawRange();
         char *vertexData = reinterpret_cast<char*>(mesh.vertices.data());
         lmSetGeometry(ctx, NULL,
                 LM_FLOAT, vertexData + offsetof(MeshVertex, position), sizeof(MeshVertex),
                 LM_FLOAT, vertexData + offsetof(MeshVertex, normal), sizeof(MeshVertex),
                 LM_FLOAT, vertexData + offsetof(MeshVertex, texCoord), sizeof(MeshVertex),
-                mesh.indices.size(), LM_UNSIGNED_INT, mesh.indices.data());
+                range.indexCount, LM_UNSIGNED_INT, mesh.indices.data() + range.firstIndex);
 
         // Set GL drawing settings for lightmapper to work properly
         glDisable(GL_CULL_FACE);
@@ -536,8 +707,7 @@ void bakeLightmap(GLuint *texture, Mesh &mesh, GLuint shaderProgram) {
             uniforms.lightIntensity = 0.0f; // Point light contribution should not be baked in
                                             //uniforms.lightPos = view * glm::vec4(1.0f, 1.5f, 4.5f, 1.0f);
             uniforms.ambientLightIntensity = 1.0f; // Self-irradiance in subsequent passes
-            GLint uniformLoc = glGetUniformLocation(shaderProgram, "lightmap");
-            glUniform1i(uniformLoc, 0);
+            uniforms.updateTransforms();
 
             // Draw scene
             glBindTexture(GL_TEXTURE_2D, *texture);
@@ -554,7 +724,7 @@ void bakeLightmap(GLuint *texture, Mesh &mesh, GLuint shaderProgram) {
             lmEnd(ctx);
             i++;
         }
-        printf("\rFinished baking %d triangles (%d iterations).\n", int(mesh.indices.size()) / 3, i);
+        printf("\rFinished baking %d triangles (%d iterations).\n", int(range.indexCount) / 3, i);
 
         // Postprocess texture
         float temp[w * h * 4] = { 0.0f };
@@ -576,23 +746,180 @@ void bakeLightmap(GLuint *texture, Mesh &mesh, GLuint shaderProgram) {
     lmDestroy(ctx);
 }
 
+MeshRange Mesh::drawRange() const {
+    if (lods.empty()) {
+        return { 0, (unsigned int)vertices.size(), 0, (unsigned int)indices.size() };
+    }
+    return lods[glm::clamp(lod, 0, int(lods.size()) - 1)];
+}
+
+int Mesh::cull(const glm::mat4& modelViewProjection) {
+    // Frustum planes in model space, from the rows of the matrix (Gribb & Hartmann), as (normal, distance)
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = glm::vec4(modelViewProjection[0][i], modelViewProjection[1][i], modelViewProjection[2][i], modelViewProjection[3][i]);
+    }
+    glm::vec4 planes[6] = {
+        rows[3] + rows[0], rows[3] - rows[0],
+        rows[3] + rows[1], rows[3] - rows[1],
+        rows[3] + rows[2], rows[3] - rows[2],
+    };
+
+    int visibleCount = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        // A box is outside if even its corner furthest along the normal of a plane is behind it
+        bool visible = true;
+        for (const glm::vec4& plane : planes) {
+            glm::vec3 corner(plane.x >= 0.0f ? chunks[c].max.x : chunks[c].min.x,
+                             plane.y >= 0.0f ? chunks[c].max.y : chunks[c].min.y,
+                             plane.z >= 0.0f ? chunks[c].max.z : chunks[c].min.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+                visible = false;
+                break;
+            }
+        }
+        chunkVisible[c] = visible;
+        visibleCount += visible;
+    }
+    return visibleCount;
+}
+
+void Mesh::showAllChunks() {
+    chunkVisible.assign(chunks.size(), true);
+    chunkLods.assign(chunks.size(), 0);
+}
+
+void Mesh::setLod(int level) {
+    lod = level;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        chunkLods[c] = glm::clamp(level, 0, int(chunks[c].lods.size()) - 1);
+    }
+}
+
+void Mesh::selectChunkLods(const glm::mat4& modelView, const glm::mat4& projection, int viewportHeight, float maxPixelError) {
+    for (size_t c = 0; c < chunks.size(); c++) {
+        const MeshChunk& chunk = chunks[c];
+        // Pixels per unit length at the closest possible distance of the chunk
+        glm::vec3 center = 0.5f * (chunk.min + chunk.max);
+        float radius = 0.5f * glm::length(chunk.max - chunk.min);
+        float distance = glm::length(glm::vec3(modelView * glm::vec4(center, 1.0f))) - radius;
+        float pixelsPerUnit = projection[1][1] * 0.5f * float(viewportHeight) / std::max(distance, 0.001f);
+
+        // Errors grow with the level, so take the coarsest that is fine enough
+        int current = chunkLods[c];
+        int level = 0;
+        for (int k = 1; k < int(chunk.lods.size()); k++) {
+            float target = (k > current) ? maxPixelError * (1.0f - LOD_HYSTERESIS) : maxPixelError;
+            if (chunk.errors[k] * pixelsPerUnit <= target) level = k;
+        }
+        chunkLods[c] = level;
+    }
+}
+
+unsigned int Mesh::bufferIndex(unsigned int index) const {
+    auto it = std::lower_bound(segmentStarts.begin(), segmentStarts.end(), index);
+    assert(it != segmentStarts.end() && *it == index);
+    return bufferSegmentStarts[it - segmentStarts.begin()];
+}
+
 void Mesh::draw() {
     glBindVertexArray(vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(unsigned short) : sizeof(unsigned int);
+
+    // Packed vertices are decoded with the chunk bounds, on a texture unit next to the lightmap.
+    // They need the program compiled for them, see Shaders::meshProgram.
+    if (vertexFormat == MeshVertexFormat::Packed) {
+        glActiveTexture(GL_TEXTURE0 + BUFFER_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, chunkBoundsTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    if (primitive == GL_TRIANGLE_STRIP) {
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(restartIndex);
+    }
+
+    if (chunks.empty()) {
+        MeshRange range = drawRange();
+        unsigned int first = bufferIndex(range.firstIndex);
+        unsigned int count = bufferIndex(range.firstIndex + range.indexCount) - first;
+        glDrawElements(primitive, count, indexType, (void*)(first * indexSize));
+        drawnTriangles = range.indexCount / 3;
+    }
+    else {
+        // Submit the visible chunks in one call, merging ranges that follow each other in the index buffer
+        std::vector<GLsizei> counts;
+        std::vector<const void*> offsets;
+        std::vector<GLint> baseVertices;
+        unsigned int end = 0;
+        auto addRange = [&](unsigned int firstIndex, unsigned int indexCount, GLint baseVertex) {
+            if (indexCount == 0) return;
+            unsigned int first = bufferIndex(firstIndex);
+            unsigned int count = bufferIndex(firstIndex + indexCount) - first;
+            if (!counts.empty() && first == end && baseVertex == baseVertices.back()) {
+                counts.back() += count;
+            }
+            else {
+                counts.push_back(count);
+                offsets.push_back((void*)(first * indexSize));
+                baseVertices.push_back(baseVertex);
+            }
+            end = first + count;
+        };
+        drawnTriangles = 0;
+        for (size_t c = 0; c < chunks.size(); c++) {
+            if (!chunkVisible[c]) continue;
+            const MeshChunk& chunk = chunks[c];
+            int level = chunkLods[c];
+            MeshRange range = chunk.lods[level];
+            GLint baseVertex = relativeIndices ? range.firstVertex : 0;
+
+            // Where a neighbour is coarser, its seam replaces the rings on that side
+            int previousLevel = (chunk.joinsPrevious) ? chunkLods[c - 1] : level;
+            int nextLevel = (c + 1 < chunks.size() && chunks[c + 1].joinsPrevious) ? chunkLods[c + 1] : level;
+            const MeshRange *seams[2] = { nullptr, nullptr };
+            if (previousLevel > level) seams[0] = &chunk.seams[chunk.seamIndex(level, previousLevel, 0)];
+            if (nextLevel > level) seams[1] = &chunk.seams[chunk.seamIndex(level, nextLevel, 1)];
+            for (int side = 0; side < 2; side++) {
+                if (seams[side] && seams[side]->indexCount > 0) {
+                    range.indexCount -= chunk.ringIndexCounts[level];
+                    if (side == 0) range.firstIndex += chunk.ringIndexCounts[level];
+                }
+                else {
+                    seams[side] = nullptr;
+                }
+            }
+
+            if (seams[0]) addRange(seams[0]->firstIndex, seams[0]->indexCount, baseVertex);
+            addRange(range.firstIndex, range.indexCount, baseVertex);
+            if (seams[1]) addRange(seams[1]->firstIndex, seams[1]->indexCount, baseVertex);
+            drawnTriangles += (range.indexCount + (seams[0] ? seams[0]->indexCount : 0) + (seams[1] ? seams[1]->indexCount : 0)) / 3;
+        }
+        if (!counts.empty()) {
+            glMultiDrawElementsBaseVertex(primitive, counts.data(), indexType, offsets.data(), counts.size(), baseVertices.data());
+        }
+    }
+
+    if (primitive == GL_TRIANGLE_STRIP) {
+        glDisable(GL_PRIMITIVE_RESTART);
+    }
 }
 
 void Spheres::draw() {
     glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances.size());
 }
 
 void Cylinders::draw() {
+    // Atom positions on the same texture unit as the chunk bounds of meshes
+    glActiveTexture(GL_TEXTURE0 + BUFFER_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, atomTexture);
+    glActiveTexture(GL_TEXTURE0);
+
     glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+    glDrawArraysInstanced(GL_TRIANGLES, 0, cutPlanes() ? 18 : 12, bonds.size());
 }
 
 // TODO Make this a DrawObject member function?
@@ -601,7 +928,7 @@ void draw(DrawObject &object, GLuint shaderProgram, Uniforms &uniforms) {
     glUseProgram(shaderProgram);
 
     // Set uniforms
-    uniforms.setUniforms(shaderProgram);
+    uniforms.uploadParameters();
 
     // Draw object
     object.draw();
@@ -2,9 +2,12 @@
 
 #include <GL/glew.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <string>
 #include <vector>
 #include "input.h"
 #include "spline.h"
+#include "profile.h"
+#include "mesh.h"
 
 struct Camera {
     float yaw = -25.0f;
@@ -16,19 +19,28 @@ struct Camera {
     void update(MouseState mouse);
 };
 
-// Load vertex and fragment shader from files and compile them into a shader program
-GLuint createShaderProgram(const char* vertexPath, const char* fragmentPath);
+// Uniform buffer binding points of the Transforms and Parameters blocks, which createShaderProgram connects every program to
+const GLuint TRANSFORM_BLOCK_BINDING = 0;
+const GLuint PARAMETER_BLOCK_BINDING = 1;
+
+// Texture units of the samplers, which createShaderProgram sets once
+const int LIGHTMAP_TEXTURE_UNIT = 0;
+const int BUFFER_TEXTURE_UNIT = 1;  // Chunk bounds of meshes, atoms of cylinders
+
+// Load vertex and fragment shader from files and compile them into a shader program.
+// Defines (e.g. "#define MODE 1\n") are inserted after the #version line of both, to compile variants of one shader.
+GLuint createShaderProgram(const char* vertexPath, const char* fragmentPath, const std::string& defines = "");
+// Load a vertex shader whose outputs are captured into one interleaved buffer with transform feedback, in the given order
+GLuint createTransformFeedbackProgram(const char* vertexPath, const std::vector<const char*>& varyings);
+
+// Vertex format of a mesh on the GPU
+enum class MeshVertexFormat {
+    Full,    // MeshVertex
+    Packed,  // PackedMeshVertex
+};
 
 // TODO Destructor
 struct Shaders {
-    GLuint meshWireframeProgram = createShaderProgram(
-            "../src/shaders/mesh_vertex.glsl",
-            "../src/shaders/wireframe_fragment.glsl"
-            );
-    GLuint meshProgram = createShaderProgram(
-            "../src/shaders/mesh_vertex.glsl",
-            "../src/shaders/mesh_fragment.glsl"
-            );
     GLuint sphereWireframeProgram = createShaderProgram(
             "../src/shaders/sphere_vertex.glsl",
             "../src/shaders/wireframe_fragment.glsl"
@@ -37,14 +49,48 @@ struct Shaders {
             "../src/shaders/sphere_vertex.glsl",
             "../src/shaders/sphere_fragment.glsl"
             );
-    GLuint cylinderWireframeProgram = createShaderProgram(
-            "../src/shaders/cylinder_vertex.glsl",
-            "../src/shaders/wireframe_fragment.glsl"
-            );
-    GLuint cylinderProgram = createShaderProgram(
-            "../src/shaders/cylinder_vertex.glsl",
-            "../src/shaders/cylinder_fragment.glsl"
-            );
+    // Meshes are compiled for each vertex format, see meshProgram()
+    GLuint meshWireframePrograms[2];
+    GLuint meshPrograms[2];
+    // Cylinders are compiled for each mode, with and without cut planes, see cylinderProgram()
+    GLuint cylinderWireframePrograms[3][2];
+    GLuint cylinderPrograms[3][2];
+
+    Shaders();
+    // Program for meshes with full or packed vertices (see Mesh::setVertexFormat)
+    GLuint meshProgram(MeshVertexFormat vertexFormat, bool wireframe) const {
+        return (wireframe ? meshWireframePrograms : meshPrograms)[vertexFormat == MeshVertexFormat::Packed];
+    }
+    // Program for cylinders in mode 0 (simple), 1 (rounded) or 2 (ribbon), with the ends cut by the planes
+    // between neighbouring bonds or perpendicular to the axis (see Cylinders::cutPlanes)
+    GLuint cylinderProgram(int mode, bool cutPlanes, bool wireframe) const {
+        return (wireframe ? cylinderWireframePrograms : cylinderPrograms)[mode][cutPlanes];
+    }
+};
+
+// Per-frame transforms in the std140 layout of the Transforms uniform block. They are computed once per frame on the
+// CPU and uploaded into one uniform buffer that all programs share, instead of being set and derived per draw.
+struct TransformBlock {
+    glm::mat4 modelView;
+    glm::mat4 projection;
+    glm::mat4 normalMatrix;  // Inverse transpose of the upper 3x3 of modelView, in a mat4 since std140 pads mat3 columns
+    glm::vec4 viewUp;        // World up direction in view space, for billboards
+};
+
+// Draw settings in the std140 layout of the Parameters uniform block, shared by all programs like the transforms
+struct ParameterBlock {
+    glm::vec3 lightPos;
+    float lightIntensity;
+    float ambientLightIntensity;
+    float sphereRadius;
+    float cylinderRadius;
+    float pitch;
+    float width;
+    int drawNormals;
+    int drawTexture;
+    int checkerboard;
+    int raytraced;
+    float padding[3];  // Blocks are a multiple of 16 bytes
 };
 
 // Uniform data to send to shaders
@@ -62,37 +108,47 @@ struct Uniforms {
     bool checkerboard = false;
     float lightIntensity = 1.0f;
     float ambientLightIntensity = 0.1f;
-    float sphereRadius = 1.0f;
+    float sphereRadius = 1.0f;  // Scales the radius of each sphere
     bool raytraced = true;
     float cylinderRadius = 0.5f;
-    int cylinderMode = 0;
     float pitch = 0.5f;
     float width = 0.25f;
 
-    // Update MVP matrices and light position
+    // Update MVP matrices and light position, and the transforms
     void updateMatrices(GLFWwindow *window, Camera &camera);
+    // Compute the transforms from model, view and projection and upload them to the shared uniform buffer
+    void updateTransforms();
 
-    // Call GL functions to set all uniforms for a given shader.
-    // NOTE When introducing new uniforms, they must be manually added to this function as well
-    void setUniforms(GLuint shaderProgram);
+    // Upload the parameters to the uniform buffer that all programs share, if they changed since the last upload.
+    // NOTE When introducing new uniforms, they must be added to ParameterBlock, this function and the Parameters
+    //      block of the shaders as well
+    void uploadParameters();
 };
 
-struct MeshVertex {
-    glm::vec3 position;
-    glm::vec3 normal;
-    glm::vec2 texCoord;
+// Mesh vertex in 16 bytes instead of 32. The position is quantized within the bounds of a chunk of the mesh, and the
+// normal is octahedral encoded (Cigolle et al. 2014). Texture coordinates must be between 0 and 1.
+struct PackedMeshVertex {
+    unsigned short position[3];
+    unsigned short chunk;
+    short normal[2];
+    unsigned short texCoord[2];
 };
 
-struct SphereVertex {
+// Sphere impostor, drawn as one instance of a quad. Positions and radii are kept apart from the colours,
+// so that moving the spheres (e.g. to the next frame of a trajectory) is a single contiguous upload.
+struct SphereInstance {
     glm::vec3 position;
+    float radius;
 };
 
-struct CylinderVertex {
-    glm::vec3 aPos;
-    glm::vec3 bPos;
-    glm::vec3 aCPN;
-    glm::vec3 bCPN;
-    glm::vec3 startDir;
+// Cylinder impostor between atoms a and b, by index into a buffer of atom positions that is shared with the sphere
+// impostors (SphereInstance), so that moving the atoms moves the cylinders too. The atoms before a and after b along
+// the chain, or -1, give the planes that cut the ends so that consecutive cylinders join without gaps.
+struct CylinderBond {
+    int previous;
+    int a;
+    int b;
+    int next;
 };
 
 // Simple struct to help with drawing
@@ -104,34 +160,122 @@ struct DrawObject {
     virtual void draw() = 0;
 };
 
+// How the index buffer of a mesh is laid out on the GPU
+enum class MeshIndexMode {
+    Triangles,  // Triangle lists
+    Strips,     // Triangle strips separated by primitive restarts, best with the ring order of spline meshes
+};
+
+// Average cache miss ratio of a mesh before and after optimizeMeshIndices
+struct VertexCacheStats {
+    float acmrBefore;
+    float acmrAfter;
+};
+
 struct Mesh : DrawObject {
     GLuint ibo;
     std::vector<MeshVertex> vertices;
     std::vector<unsigned int> indices;
+    // Vertex and index ranges of the parts this mesh was built from, if any
+    std::vector<MeshRange> ranges;
+    // Levels of detail, and the one to draw. Switching levels only changes the index range.
+    std::vector<MeshRange> lods;
+    int lod = 0;
+    // Chunks that can be culled, which of them draw() submits, and at which level of detail
+    std::vector<MeshChunk> chunks;
+    std::vector<bool> chunkVisible;
+    std::vector<int> chunkLods;
+    // Number of triangles submitted by the last draw()
+    size_t drawnTriangles = 0;
+
+    // Layout of the index buffer. The indices above stay 32 bit triangle lists, the buffer uses 16 bit indices relative
+    // to the first vertex of each chunk where possible, and may use strips. Segments of indices that are drawn as a whole
+    // (e.g. a seam, or the rings of a chunk between its seams) are converted separately. Their starts in indices and
+    // in the buffer are kept, with the ends as last entries.
+    GLenum primitive = GL_TRIANGLES;
+    GLenum indexType = GL_UNSIGNED_INT;
+    unsigned int restartIndex = 0xFFFFFFFF;
+    bool relativeIndices = false;
+    size_t indexBufferSize = 0;
+    std::vector<unsigned int> segmentStarts;
+    std::vector<unsigned int> bufferSegmentStarts;
+    // Vertex format of the vertex buffer. The vertices above always stay in full precision.
+    // Packed vertices need the minimum and extent of every chunk, which are kept in a buffer texture.
+    MeshVertexFormat vertexFormat = MeshVertexFormat::Full;
+    size_t vertexBufferSize = 0;
+    GLuint chunkBoundsBuffer = 0;
+    GLuint chunkBoundsTexture = 0;
 
-    // TODO References?
+    // Takes ownership of the vertices and indices, pass them with std::move to avoid copies
     Mesh(std::vector<MeshVertex> vertices, std::vector<unsigned int> indices);
+    Mesh(MeshData data, MeshIndexMode indexMode = MeshIndexMode::Triangles, MeshVertexFormat vertexFormat = MeshVertexFormat::Full);
+    // Upload the vertices again in another format, e.g. to compare formats
+    void setVertexFormat(MeshVertexFormat format);
+    // Range of the current level of detail, or the whole mesh if there are no levels
+    MeshRange drawRange() const;
+    // Use one level of detail for the whole mesh
+    void setLod(int level);
+    // Choose the level of detail of each chunk, the coarsest whose error projects to at most maxPixelError pixels.
+    // Chunks only switch to a coarser level once it is clearly below the target, so that they don't pop back and forth.
+    void selectChunkLods(const glm::mat4& modelView, const glm::mat4& projection, int viewportHeight, float maxPixelError);
+    // Hide the chunks whose bounds are outside the view frustum, and return the number of visible chunks
+    int cull(const glm::mat4& modelViewProjection);
+    void showAllChunks();
     void draw();
+
+private:
+    // Position in the index buffer of a segment boundary in indices
+    unsigned int bufferIndex(unsigned int index) const;
 };
 
 struct Spheres : DrawObject {
-    std::vector<SphereVertex> vertices;
+    // Instances are in vbo, and their colours in colorBuffer
+    GLuint colorBuffer;
+    std::vector<SphereInstance> instances;
+    // RGBA8, with red in the lowest byte
+    std::vector<unsigned int> colors;
 
-    Spheres(std::vector<SphereVertex> vertices);
+    Spheres(std::vector<SphereInstance> instances, std::vector<unsigned int> colors);
+    // Replace the positions and radii of all spheres, e.g. for a trajectory frame
+    void update(const std::vector<SphereInstance>& instances);
     void draw();
 };
 
 struct Cylinders : DrawObject {
-    std::vector<CylinderVertex> vertices;
+    // Buffer texture over the atom positions, read by the vertex shader
+    GLuint atomTexture;
+    std::vector<CylinderBond> bonds;
+    // Mode to draw in, see Shaders::cylinderProgram, and whether bonds join their neighbours with cut planes.
+    // Without cut planes, the joints are left to e.g. sphere impostors.
+    int mode = 0;
+    bool joined = true;
 
-    Cylinders(std::vector<CylinderVertex> vertices);
+    // atomBuffer holds one SphereInstance per atom, e.g. Spheres::vbo
+    Cylinders(std::vector<CylinderBond> bonds, GLuint atomBuffer);
+    // Whether the program for the current mode needs cut planes. Rounded cylinders never do, their caps fill the joints.
+    bool cutPlanes() const {
+        return joined && mode != 1;
+    }
+    // Draws 18 vertices per bond with cut planes, 12 without
     void draw();
 };
 
 // Helper functions to create DrawObjects from a set of input points
-Mesh createSplineMesh(BSpline& spline, int samples, int segments, float radius);
-Spheres createSpheres(std::vector<glm::vec3> &points);
-Cylinders createCylinders(std::vector<glm::vec3> &points);
+// Spline meshes use rotation minimizing frames by default, otherwise the orientation vectors are followed directly.
+// These helpers use a flat ribbon everywhere, use buildSplineMeshData for other cross-sections.
+Mesh createSplineMesh(BSpline& spline, int samples = 50, int segments = 8, float radius = 1.0f, bool rotationMinimizingFrames = true);
+// Spline mesh for all chains of a set in a single buffer, with one range per chain.
+// Chains are sampled according to their length and built in parallel.
+Mesh createSplineMesh(SplineSet& splines, int samplesPerUnitLength, int segments = 8, float radius = 1.0f, bool rotationMinimizingFrames = true);
+// Reorder the triangles of every index segment of a mesh for the vertex cache, which keeps all ranges valid
+VertexCacheStats optimizeMeshIndices(MeshData& data);
+// Spline meshes with rings placed by curvature and twist instead of evenly, so that the surface
+// deviates at most maxDeviation from the exact tube. Straight pieces get far fewer rings.
+Mesh createAdaptiveSplineMesh(BSpline& spline, float maxDeviation, int segments = 8, float radius = 1.0f, bool rotationMinimizingFrames = true);
+Mesh createAdaptiveSplineMesh(SplineSet& splines, float maxDeviation, int segments = 8, float radius = 1.0f, bool rotationMinimizingFrames = true);
+Spheres createSpheres(std::vector<glm::vec3> &points, float radius = 1.0f, glm::vec3 color = glm::vec3(1.0f, 0.5f, 0.5f));
+// Cylinders between consecutive spheres, as one chain
+Cylinders createCylinders(const Spheres& spheres);
 
 void bakeLightmap(GLuint *texture, Mesh &mesh, GLuint shaderProgram);
 
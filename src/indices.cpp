@@ -0,0 +1,152 @@
+#include "indices.h"
+#include <algorithm>
+#include <deque>
+
+size_t vertexCacheMisses(const unsigned int *indices, size_t indexCount, int cacheSize) {
+    std::deque<unsigned int> cache;
+    size_t misses = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        if (std::find(cache.begin(), cache.end(), indices[i]) != cache.end()) continue;
+        misses++;
+        cache.push_back(indices[i]);
+        if (int(cache.size()) > cacheSize) cache.pop_front();
+    }
+    return misses;
+}
+
+void optimizeVertexCache(unsigned int *indices, size_t indexCount, int cacheSize) {
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) return;
+
+    // Work with vertex numbers local to the range the triangles use
+    unsigned int firstVertex = *std::min_element(indices, indices + indexCount);
+    unsigned int lastVertex = *std::max_element(indices, indices + indexCount);
+    int vertexCount = lastVertex - firstVertex + 1;
+
+    // Triangles around each vertex, and the number of those not emitted yet
+    std::vector<int> liveTriangles(vertexCount, 0);
+    for (size_t i = 0; i < indexCount; i++) {
+        liveTriangles[indices[i] - firstVertex]++;
+    }
+    std::vector<int> adjacencyStart(vertexCount + 1, 0);
+    for (int v = 0; v < vertexCount; v++) {
+        adjacencyStart[v + 1] = adjacencyStart[v] + liveTriangles[v];
+    }
+    std::vector<int> adjacency(indexCount);
+    std::vector<int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t i = 0; i < indexCount; i++) {
+        adjacency[fill[indices[i] - firstVertex]++] = i / 3;
+    }
+
+    std::vector<unsigned int> output;
+    output.reserve(indexCount);
+    std::vector<bool> emitted(triangleCount, false);
+    // Time at which each vertex last entered the cache
+    std::vector<int> cacheTime(vertexCount, 0);
+    int time = cacheSize + 1;
+    // Vertices of emitted triangles, to go back to when a fan runs out of triangles
+    std::vector<int> deadEnds;
+    int cursor = 0;
+
+    // Fan out from one vertex at a time, emitting all of its remaining triangles
+    int fanning = 0;
+    std::vector<int> candidates;
+    while (fanning >= 0) {
+        candidates.clear();
+        for (int a = adjacencyStart[fanning]; a < adjacencyStart[fanning + 1]; a++) {
+            int t = adjacency[a];
+            if (emitted[t]) continue;
+            emitted[t] = true;
+            for (int k = 0; k < 3; k++) {
+                int v = indices[3 * t + k] - firstVertex;
+                output.push_back(indices[3 * t + k]);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > cacheSize) {
+                    cacheTime[v] = time++;
+                }
+            }
+        }
+
+        // Next, the vertex that is most likely still in the cache after its remaining triangles have been emitted
+        int next = -1;
+        int bestPriority = -1;
+        for (int v : candidates) {
+            if (liveTriangles[v] <= 0) continue;
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+                priority = time - cacheTime[v];
+            }
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+
+        // Otherwise a recently used vertex with triangles left, or the next vertex with any
+        while (next < 0 && !deadEnds.empty()) {
+            int v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[v] > 0) next = v;
+        }
+        while (next < 0 && cursor < vertexCount) {
+            if (liveTriangles[cursor] > 0) next = cursor;
+            cursor++;
+        }
+        fanning = next;
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+// Vertex that continues a strip ending in a and b with the given triangle, or -1 if the triangle does not continue it.
+// Even triangles of a strip are (a, b, c), odd ones (b, a, c).
+static long long stripContinuation(unsigned int a, unsigned int b, bool odd, const unsigned int *triangle) {
+    if (odd) std::swap(a, b);
+    for (int r = 0; r < 3; r++) {
+        if (triangle[r] == a && triangle[(r + 1) % 3] == b) return triangle[(r + 2) % 3];
+    }
+    return -1;
+}
+
+std::vector<unsigned int> triangleStrips(const unsigned int *indices, size_t indexCount, unsigned int restartIndex) {
+    size_t triangleCount = indexCount / 3;
+    std::vector<unsigned int> strips;
+    std::vector<unsigned int> strip, bestStrip;
+    size_t t = 0;
+    while (t < triangleCount) {
+        // Try every rotation of the first triangle, with and without a leading repeated vertex
+        // (which flips the parity of the strip), and keep the start that covers the most triangles
+        size_t bestEnd = 0;
+        for (int start = 0; start < 6; start++) {
+            const unsigned int *first = indices + 3 * t;
+            unsigned int x = first[start % 3], y = first[(start + 1) % 3], z = first[(start + 2) % 3];
+            if (start < 3) {
+                strip = { x, y, z };
+            }
+            else {
+                // Triangle 1 of (y, y, x, z) is (x, y, z)
+                strip = { y, y, x, z };
+            }
+
+            size_t end = t + 1;
+            while (end < triangleCount) {
+                size_t n = strip.size();
+                long long next = stripContinuation(strip[n - 2], strip[n - 1], (n - 2) % 2 == 1, indices + 3 * end);
+                if (next < 0) break;
+                strip.push_back(next);
+                end++;
+            }
+            if (end > bestEnd) {
+                bestEnd = end;
+                bestStrip = strip;
+            }
+        }
+
+        if (!strips.empty()) strips.push_back(restartIndex);
+        strips.insert(strips.end(), bestStrip.begin(), bestStrip.end());
+        t = bestEnd;
+    }
+    return strips;
+}
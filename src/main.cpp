@@ -1,4 +1,5 @@
 #include "gl.h"
+#include "tessellation.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include "imgui.h"
@@ -7,6 +8,7 @@
 #include <glm/ext/scalar_constants.hpp>
 #include "window.h"
 #include <iostream>
+#include <string>
 
 // Set GL version
 const char* glsl_version = "#version 330";
@@ -30,7 +32,16 @@ struct Settings {
     bool drawMesh = true;
     bool drawSpheres = false;
     bool drawCylinders = false;
+    int cylinderMode = 0;
+    bool cylinderJoins = true;
     int lod = 0;
+    float pixelError = 2.0f;
+    bool frustumCulling = true;
+    bool packedVertices = false;
+    bool animateSpline = false;
+    // Statistics of the last frame
+    size_t meshTriangles = 0;
+    size_t meshVertexBytes = 0;
 };
 
 void settingsUI(Settings &settings) {
@@ -80,13 +91,17 @@ void settingsUI(Settings &settings) {
         ImGui::SetNextItemWidth(128);
         ImGui::SliderFloat("Radius##Cylinder", &settings.uniforms.cylinderRadius, 0.05f, 1.0f, "%.2f", ImGuiSliderFlags_NoRoundToFormat);
         ImGui::SetNextItemWidth(128);
-        ImGui::Combo("Mode", &settings.uniforms.cylinderMode, "Simple\0Rounded\0Ribbon\0");
-        if (settings.uniforms.cylinderMode != 2) ImGui::BeginDisabled();
+        ImGui::Combo("Mode", &settings.cylinderMode, "Simple\0Rounded\0Ribbon\0");
+        // Rounded caps fill the joints by themselves
+        if (settings.cylinderMode == 1) ImGui::BeginDisabled();
+        ImGui::Checkbox("Cut plane joins", &settings.cylinderJoins);
+        if (settings.cylinderMode == 1) ImGui::EndDisabled();
+        if (settings.cylinderMode != 2) ImGui::BeginDisabled();
         ImGui::SetNextItemWidth(128);
         ImGui::SliderFloat("Pitch", &settings.uniforms.pitch, 0.05f, 1.0f, "%.2f", ImGuiSliderFlags_NoRoundToFormat);
         ImGui::SetNextItemWidth(128);
         ImGui::SliderFloat("Width", &settings.uniforms.width, 0.05f, 1.0f, "%.2f", ImGuiSliderFlags_NoRoundToFormat);
-        if (settings.uniforms.cylinderMode != 2) ImGui::EndDisabled();
+        if (settings.cylinderMode != 2) ImGui::EndDisabled();
         if (!settings.drawCylinders) ImGui::EndDisabled();
     }
     ImGui::Unindent();
@@ -101,6 +116,17 @@ void settingsUI(Settings &settings) {
         ImGui::SetNextItemWidth(128);
         const char *lods[] = { "Auto", "0", "1", "2" };
         ImGui::Combo("LOD", &settings.lod, lods, 4);
+        if (settings.lod != 0) ImGui::BeginDisabled();
+        ImGui::SetNextItemWidth(128);
+        ImGui::SliderFloat("Pixel error", &settings.pixelError, 0.25f, 16.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+        if (settings.lod != 0) ImGui::EndDisabled();
+        ImGui::Checkbox("Frustum culling", &settings.frustumCulling);
+        if (settings.animateSpline) ImGui::BeginDisabled();
+        ImGui::Checkbox("Packed vertices", &settings.packedVertices);
+        if (settings.animateSpline) ImGui::EndDisabled();
+        ImGui::Checkbox("Animate on GPU", &settings.animateSpline);
+        ImGui::Text("Triangles: %zu", settings.meshTriangles);
+        ImGui::Text("Vertex buffer: %zu KiB", settings.meshVertexBytes / 1024);
         ImGui::SetNextItemWidth(128);
         const char *textureModes[] = { "Off", "On", "Texture only" };
         ImGui::Combo("Texture", &settings.uniforms.drawTexture, textureModes, 3);
@@ -112,7 +138,41 @@ void settingsUI(Settings &settings) {
     ImGui::End();
 }
 
-int main() {
+// Compare vertices generated by the tessellator with a CPU mesh built with the same rings and analytic normals
+static void printTessellationDeviation(SplineTessellator& tessellator, BSpline& spline,
+        const std::vector<float>& sampleLengths, MeshData referenceData) {
+    Mesh reference(std::move(referenceData));
+    tessellator.update(spline, sampleLengths, reference);
+    std::vector<MeshVertex> gpuVertices = readMeshVertices(reference);
+    float positionError = 0.0f;
+    float normalError = 0.0f;
+    float texCoordError = 0.0f;
+    for (size_t i = 0; i < gpuVertices.size(); i++) {
+        positionError = std::max(positionError, glm::distance(gpuVertices[i].position, reference.vertices[i].position));
+        normalError = std::max(normalError, glm::distance(gpuVertices[i].normal, reference.vertices[i].normal));
+        texCoordError = std::max(texCoordError, glm::distance(gpuVertices[i].texCoord, reference.vertices[i].texCoord));
+    }
+    std::cout << "GPU tessellation: max deviation " << positionError << " in position, " << normalError << " in normal, "
+              << texCoordError << " in texture coordinates" << std::endl;
+    GLuint buffers[2] = { reference.vbo, reference.ibo };
+    glDeleteBuffers(2, buffers);
+    glDeleteVertexArrays(1, &reference.vao);
+}
+
+int main(int argc, char **argv) {
+    // Command line options
+    bool checkTessellation = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--check-tessellation") {
+            checkTessellation = true;
+        }
+        else {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+            std::cerr << "Usage: " << argv[0] << " [--check-tessellation]" << std::endl;
+            return 1;
+        }
+    }
+
     // Initialize GL context and create window
     GLFWwindow *window = initWindow();
 
@@ -134,29 +194,66 @@ int main() {
 
     // Create spline
     BSpline spline = exampleSpline(false);
-    std::vector<glm::vec3> controlPoints = spline.getControlPoints();
+    ArrayView<const glm::vec3> splinePoints = spline.getControlPoints();
+    std::vector<glm::vec3> controlPoints(splinePoints.begin(), splinePoints.end());
 
-    // Create ball-and-stick objects
+    // Create ball-and-stick objects. The cylinders take the atom positions from the spheres.
     Spheres spheres = createSpheres(controlPoints);
-    Cylinders cylinders = createCylinders(controlPoints);
+    Cylinders cylinders = createCylinders(spheres);
     //auto curvePoints = spline.generateCurve(nSegments);
-    //Cylinders cylinders = createCylinders(curvePoints);
+    //Spheres curveSpheres = createSpheres(curvePoints);
+    //Cylinders cylinders = createCylinders(curveSpheres);
 
     // Create spline mesh at several levels of detail
     std::cout << "Building meshes..." << std::endl;
-    unsigned int nSegments = (unsigned int)(spline.arcLength(1.0f)); // One segment per unit of distance at lowest LOD
-    // NOTE Because vertices are reused, wireframe indices are only correct when loopResolution is 4 / 10 / 16
-    Mesh lod0 = createSplineMesh(spline, nSegments * 4, 16, 1.0f);
-    std::cout << "LOD 0: " << lod0.vertices.size() << " vertices" << std::endl;
-    Mesh lod1 = createSplineMesh(spline, nSegments * 2, 10, 1.0f);
-    std::cout << "LOD 1: " << lod1.vertices.size() << " vertices" << std::endl;
-    Mesh lod2 = createSplineMesh(spline, nSegments * 1, 4, 1.0f);
-    std::cout << "LOD 2: " << lod2.vertices.size() << " vertices" << std::endl;
+    // Rings are placed adaptively, with the same maximum deviation along the spline as around each ring.
+    // The levels are nested: each coarser level halves both the rings and the loop resolution (16 / 8 / 4),
+    // so they all share the vertices of LOD 0 and only have their own indices.
+    // NOTE Because vertices are reused, wireframe indices are only correct when loopResolution is 4 / 8 / 16,
+    //      and not in the seams between chunks of different levels
+    auto ringDeviation = [](int loopResolution, float radius) {
+        return radius * (1.0f - std::cos(glm::pi<float>() / float(loopResolution)));
+    };
+    const int lodLevels = 3;
+    const int loopResolution = 16;
+    spline.updateCaches();
+    SplineProfiles profiles = exampleProfiles(spline.spanCount(), loopResolution);
+    std::vector<float> coarseLengths = spline.adaptiveSampleLengths(ringDeviation(loopResolution >> (lodLevels - 1), 1.0f), 1.0f, true);
+    coarseLengths = addProfileSteps(spline, profiles, coarseLengths);
+    MeshData meshData = buildNestedSplineMeshData(spline, coarseLengths, profiles, lodLevels, 1.0f, true, MeshNormals::AnalyticStretch);
+    VertexCacheStats cacheStats = optimizeMeshIndices(meshData);
+    std::cout << "Vertex cache: ACMR " << cacheStats.acmrBefore << " before, " << cacheStats.acmrAfter << " after reordering" << std::endl;
+    // Strips make the index buffer smaller, but optimized triangle lists need fewer vertex shader runs
+    Mesh mesh(std::move(meshData), MeshIndexMode::Triangles);
+    std::cout << "Mesh: " << mesh.vertices.size() << " vertices, " << mesh.indexBufferSize / 1024 << " KiB of "
+              << ((mesh.indexType == GL_UNSIGNED_SHORT) ? 16 : 32) << " bit indices" << std::endl;
+    for (int lod = 0; lod < lodLevels; lod++) {
+        std::cout << "LOD " << lod << ": " << mesh.lods[lod].indexCount / 3 << " triangles" << std::endl;
+    }
 
     // Bake lightmap
     std::cout << "Baking lightmap..." << std::endl;
     GLuint lightmap = 0;
-    bakeLightmap(&lightmap, lod1, shaders.meshProgram); // Use LOD 1 as tradeoff between quality and generation speed
+    mesh.setLod(1); // Use LOD 1 as tradeoff between quality and generation speed, the texture coordinates are shared
+    bakeLightmap(&lightmap, mesh, shaders.meshProgram(mesh.vertexFormat, false));
+
+    // Regenerate the mesh vertices on the GPU when the spline moves, with rings at the same fractions of its length.
+    // The GPU uses analytic normals without stretch, which --check-tessellation compares against a CPU mesh.
+    std::vector<float> sampleLengths = subdivideSampleLengths(coarseLengths, lodLevels - 1);
+    std::vector<float> sampleFractions = sampleLengths;
+    float splineLength = spline.arcLength(1.0f);
+    for (float& fraction : sampleFractions) {
+        fraction /= splineLength;
+    }
+    ArrayView<const glm::vec3> splineOrientations = spline.getOrientationVectors();
+    std::vector<glm::vec3> orientationVectors(splineOrientations.begin(), splineOrientations.end());
+    std::vector<MeshChunk> staticChunks = mesh.chunks;
+    SplineTessellator tessellator(profiles, 1.0f, true);
+    if (checkTessellation) {
+        printTessellationDeviation(tessellator, spline, sampleLengths,
+            buildNestedSplineMeshData(spline, coarseLengths, profiles, lodLevels, 1.0f, true, MeshNormals::Analytic));
+    }
+    bool animated = false;
 
     // Main loop
     while (!glfwWindowShouldClose(window)) {
@@ -183,44 +280,90 @@ int main() {
         glfwGetWindowSize(window, &w, &h);
         glViewport(0, 0, w, h);
 
-        // Select level of detail
-        DrawObject *mesh;
-        switch (settings.lod) {
-            case 0:
-                if (camera.dist > 200.0f) { mesh = &lod2; }
-                else if (camera.dist > 50.0f) { mesh = &lod1; }
-                else { mesh = &lod0; }
-                break;
-            case 1: mesh = &lod0; break;
-            case 2: mesh = &lod1; break;
-            case 3: mesh = &lod2; break;
+        // Wave the spline and regenerate the mesh on the GPU, only uploading control points and ring frames.
+        // Moving the spheres also moves the cylinders between them.
+        // When the animation stops, go back to the vertices and chunk bounds of the CPU mesh.
+        if (settings.animateSpline) {
+            std::vector<glm::vec3> points = controlPoints;
+            std::vector<SphereInstance> atoms = spheres.instances;
+            float time = glfwGetTime();
+            for (size_t i = 0; i < points.size(); i++) {
+                points[i].y += 0.5f * std::sin(2.0f * time + 0.5f * float(i));
+                atoms[i].position = points[i];
+            }
+            spheres.update(atoms);
+            spline.setControlPoints(0, points, orientationVectors);
+            float totalLength = spline.arcLength(1.0f);
+            std::vector<float> lengths = sampleFractions;
+            for (float& length : lengths) {
+                length *= totalLength;
+            }
+            tessellator.update(spline, lengths, mesh);
+            animated = true;
+        }
+        else if (animated) {
+            spline.setControlPoints(0, controlPoints, orientationVectors);
+            std::vector<SphereInstance> atoms = spheres.instances;
+            for (size_t i = 0; i < controlPoints.size(); i++) {
+                atoms[i].position = controlPoints[i];
+            }
+            spheres.update(atoms);
+            mesh.chunks = staticChunks;
+            mesh.setVertexFormat(MeshVertexFormat::Full);
+            animated = false;
+        }
+
+        // Upload the mesh vertices again when the vertex format setting changes
+        MeshVertexFormat vertexFormat = (settings.packedVertices && !settings.animateSpline) ? MeshVertexFormat::Packed : MeshVertexFormat::Full;
+        if (mesh.vertexFormat != vertexFormat) mesh.setVertexFormat(vertexFormat);
+
+        // Select level of detail per chunk, from the projected size of its error, and only draw the chunks in view
+        Uniforms& uniforms = settings.uniforms;
+        if (settings.lod == 0) {
+            mesh.selectChunkLods(uniforms.view * uniforms.model, uniforms.projection, h, settings.pixelError);
+        }
+        else {
+            mesh.setLod(settings.lod - 1);
+        }
+        if (settings.frustumCulling) {
+            mesh.cull(uniforms.projection * uniforms.view * uniforms.model);
+        }
+        else {
+            mesh.showAllChunks();
         }
 
         // Bind lightmap texture
         // TODO Move into mesh?
-        GLint uniformLoc = glGetUniformLocation(shaders.meshProgram, "lightmap");
-        glUniform1i(uniformLoc, 0);
+        glActiveTexture(GL_TEXTURE0 + LIGHTMAP_TEXTURE_UNIT);
         glBindTexture(GL_TEXTURE_2D, lightmap);
 
+        // Cylinders are drawn with the program specialized for their mode and joins
+        cylinders.mode = settings.cylinderMode;
+        cylinders.joined = settings.cylinderJoins;
+        GLuint cylinderProgram = shaders.cylinderProgram(cylinders.mode, cylinders.cutPlanes(), false);
+        GLuint cylinderWireframeProgram = shaders.cylinderProgram(cylinders.mode, cylinders.cutPlanes(), true);
+
         // Draw objects
         glShadeModel(GL_SMOOTH);
         glEnable(GL_CULL_FACE);
         glEnable(GL_POLYGON_OFFSET_FILL);
         glDepthRange(0.0, 1.0);
         glPolygonOffset(0.0, 0.0);
-        if (settings.drawMesh) draw(*mesh, shaders.meshProgram, settings.uniforms);
+        if (settings.drawMesh) draw(mesh, shaders.meshProgram(mesh.vertexFormat, false), settings.uniforms);
         if (settings.drawSpheres) draw(spheres, shaders.sphereProgram, settings.uniforms);
-        if (settings.drawCylinders) draw(cylinders, shaders.cylinderProgram, settings.uniforms);
+        if (settings.drawCylinders) draw(cylinders, cylinderProgram, settings.uniforms);
         if (settings.drawWireframes) {
             // Draw wireframes with no backface culling and on top of everything else
             // TODO Make this a setting
             //glDisable(GL_CULL_FACE);
             //glDepthRange(0.0, 0.0);
             glPolygonOffset(-1.0, 0.0);
-            if (settings.drawMesh) draw(*mesh, shaders.meshWireframeProgram, settings.uniforms);
+            if (settings.drawMesh) draw(mesh, shaders.meshProgram(mesh.vertexFormat, true), settings.uniforms);
             if (settings.drawSpheres) draw(spheres, shaders.sphereWireframeProgram, settings.uniforms);
-            if (settings.drawCylinders) draw(cylinders, shaders.cylinderWireframeProgram, settings.uniforms);
+            if (settings.drawCylinders) draw(cylinders, cylinderWireframeProgram, settings.uniforms);
         }
+        settings.meshTriangles = settings.drawMesh ? mesh.drawnTriangles : 0;
+        settings.meshVertexBytes = mesh.vertexBufferSize;
 
         // Draw UI
         ImGui::Render();
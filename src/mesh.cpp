@@ -0,0 +1,472 @@
+#include "mesh.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// Number of spline samples per block of work when building meshes in parallel
+const int MESH_BLOCK_SAMPLES = 64;
+
+// Distance between the two rings placed where the cross-section profile jumps
+const float PROFILE_STEP_LENGTH = 0.05f;
+
+// Number of rings per culling chunk of spline meshes. Must be divisible by the coarsest ring step of nested levels of detail.
+const int MESH_CHUNK_RINGS = 32;
+
+// Arc length over which the twist rate of the frames is measured for analytic normals
+const float TWIST_DISTANCE = 0.01f;
+
+std::vector<float> uniformSampleLengths(BSpline& spline, int splineSamples) {
+    float totalLength = spline.arcLength(1.0f);
+    std::vector<float> targetLengths(splineSamples);
+    for (int i = 0; i < splineSamples; i++) {
+        targetLengths[i] = float(i) / float(splineSamples - 1) * totalLength;
+    }
+    return targetLengths;
+}
+
+size_t splineMeshVertexCount(int splineSamples, int loopResolution) {
+    // The first vertex of each ring is repeated at the end, for texture coordinates
+    return size_t(splineSamples) * (loopResolution + 1);
+}
+
+size_t splineMeshIndexCount(int splineSamples, int loopResolution, int step) {
+    // Two triangles per quad between consecutive rings
+    return size_t((splineSamples - 1) / step) * (loopResolution / step) * 6;
+}
+
+void buildSplineMeshIndices(int splineSamples, int loopResolution, int step, unsigned int *indices, unsigned int baseVertex) {
+    int rings = (splineSamples - 1) / step;
+    int segments = loopResolution / step;
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < segments; j++) {
+            // Vertex indices for the quad
+            unsigned int v0 = baseVertex + i * step * (loopResolution + 1) + j * step;
+            unsigned int v1 = v0 + step;
+            unsigned int v2 = v0 + step * (loopResolution + 1);
+            unsigned int v3 = v2 + step;
+            unsigned int quad[6] = { v0, v1, v2, v1, v3, v2 };
+            std::copy(quad, quad + 6, indices + (size_t(i) * segments + j) * 6);
+        }
+    }
+}
+
+void buildSplineMesh(BSpline& spline, const std::vector<float>& targetLengths, const SplineProfiles& profiles, float radius, bool rotationMinimizingFrames,
+        MeshNormals normalMode, MeshVertex *vertices, unsigned int *indices, unsigned int baseVertex, ThreadPool& pool) {
+    assert(profiles.spanCount() == spline.spanCount());
+    int loopResolution = profiles.getLoopResolution();
+    // Caches are built lazily, which must not happen in the blocks below
+    spline.updateCaches();
+    float totalLength = spline.arcLength(1.0f);
+    //std::cout << "Spline length: " << totalLength << std::endl;
+
+    // Samples are split into blocks that are processed in parallel. Every block computes the rings and
+    // face normals it needs itself, with the same code, so the result doesn't depend on the number of threads.
+    int splineSamples = targetLengths.size();
+    int nBlocks = (splineSamples + MESH_BLOCK_SAMPLES - 1) / MESH_BLOCK_SAMPLES;
+
+    // Sample points along the spline
+    std::vector<float> ts(splineSamples);
+    SplineSampleBuffer samples;
+    samples.resize(splineSamples);
+    pool.parallelFor(nBlocks, [&](int block) {
+        int first = block * MESH_BLOCK_SAMPLES;
+        int last = std::min(first + MESH_BLOCK_SAMPLES, splineSamples);
+        for (int i = first; i < last; i++) {
+            ts[i] = spline.parameterFromArcLength(targetLengths[i], totalLength);
+        }
+        spline.evaluateBatch(&ts[first], last - first, samples, first);
+    });
+
+    // Create cross-section circle for sample i, and with analytic normals also its vertex normals
+    auto createRing = [&](int i, glm::vec3 *ring, glm::vec3 *ringNormals) {
+        glm::vec3 center = samples.position(i);
+        glm::vec3 tangent = samples.tangent(i);
+        glm::vec3 normal;
+        if (rotationMinimizingFrames) {
+            // Propagated frames don't flip, and are the same across LODs at equal arc lengths
+            normal = spline.rotationMinimizingNormal(targetLengths[i], center, tangent);
+        }
+        else {
+            // NOTE Normals flip wherever the orientation vectors do, and flip points differ between LODs
+            normal = samples.normal(i);
+        }
+        glm::vec3 binormal = glm::normalize(glm::cross(tangent, normal));
+
+        // Profile of the span this sample lies in, scaled for the position within the span
+        int span = spline.spanIndex(ts[i]);
+        const CrossSectionProfile& profile = profiles.spanProfile(span);
+        float f = glm::clamp(ts[i] * float(spline.spanCount()) - float(span), 0.0f, 1.0f);
+        glm::vec2 scale = radius * profile.scale(f);
+        glm::vec3 x = scale.x * binormal;
+        glm::vec3 y = scale.y * normal;
+        // Place the profile in the plane of the frame
+        for (int j = 0; j < loopResolution; j++) {
+            ring[j] = center + (profile.points[j].x * x + profile.points[j].y * y);
+        }
+        if (normalMode == MeshNormals::Averaged) return;
+
+        // Profile normals transform with the inverse transpose of the scale. Scaling by
+        // scale.x * scale.y keeps the direction and avoids dividing by a zero scale.
+        glm::vec3 nx = scale.y * binormal;
+        glm::vec3 ny = scale.x * normal;
+        for (int j = 0; j < loopResolution; j++) {
+            ringNormals[j] = glm::normalize(profile.normals[j].x * nx + profile.normals[j].y * ny);
+        }
+        if (normalMode != MeshNormals::AnalyticStretch) return;
+
+        // Where the surface runs diagonally to the tangent, the normal tilts along the tangent. Per unit of arc length,
+        // a vertex at offset o from the center moves by 1 - dot(k, o) along the tangent, with k the curvature vector.
+        // Across the tangent, it circles the center with the twist rate w of the frame, and moves outwards when the
+        // profile grows along the span.
+        glm::vec3 d1 = spline.derivative(ts[i]);
+        glm::vec3 d2 = spline.secondDerivative(ts[i]);
+        float speed = glm::length(d1);
+        if (speed == 0.0f) return;
+        glm::vec3 curvatureVector = (d2 - glm::dot(d2, tangent) * tangent) / (speed * speed);
+        glm::vec2 growth = radius * (profile.scaleEnd - profile.scaleStart) * float(spline.spanCount()) / speed;
+
+        // Twist rate from the frame a short distance further along
+        float ds = (targetLengths[i] + TWIST_DISTANCE <= totalLength) ? TWIST_DISTANCE : -TWIST_DISTANCE;
+        float s1 = targetLengths[i] + ds;
+        SplineFrame frame1 = spline.evaluateFrame(spline.parameterFromArcLength(s1, totalLength));
+        glm::vec3 normal1 = rotationMinimizingFrames ? spline.rotationMinimizingNormal(s1, frame1.position, frame1.tangent) : frame1.normal;
+        normal1 -= glm::dot(normal1, tangent) * tangent;
+        float twistRate = std::atan2(glm::dot(glm::cross(normal, normal1), tangent), glm::dot(normal, normal1)) / ds;
+
+        for (int j = 0; j < loopResolution; j++) {
+            glm::vec3 offset = ring[j] - center;
+            float stretch = 1.0f - glm::dot(curvatureVector, offset);
+            glm::vec3 across = twistRate * glm::cross(tangent, offset) +
+                profile.points[j].x * growth.x * binormal + profile.points[j].y * growth.y * normal;
+            // Skip where the surface folds over itself
+            if (stretch > 0.0f) {
+                ringNormals[j] = glm::normalize(ringNormals[j] - (glm::dot(across, ringNormals[j]) / stretch) * tangent);
+            }
+        }
+    };
+
+    // Normals of the two triangles of each quad between ring i and i + 1
+    auto faceNormals = [&](const glm::vec3 *ring0, const glm::vec3 *ring1, glm::vec3 *normals) {
+        for (int j = 0; j < loopResolution; j++) {
+            glm::vec3 pos0 = ring0[j];
+            glm::vec3 pos1 = ring0[(j + 1) % loopResolution];
+            glm::vec3 pos2 = ring1[j];
+            glm::vec3 pos3 = ring1[(j + 1) % loopResolution];
+            // First triangle (v0, v1, v2) and second triangle (v1, v3, v2)
+            normals[2 * j] = glm::normalize(glm::cross(pos1 - pos0, pos2 - pos0));
+            normals[2 * j + 1] = glm::normalize(glm::cross(pos3 - pos1, pos2 - pos1));
+        }
+    };
+
+    // Averaged normals need the neighbouring rings, analytic normals only the current one.
+    // Only the rings and face normals around the current ring are kept, and each vertex and index is written exactly once.
+    // Output is never read back, so it may point to write-combined memory such as a mapped GL buffer.
+    bool averaged = normalMode == MeshNormals::Averaged;
+    pool.parallelFor(nBlocks, [&](int block) {
+        int first = block * MESH_BLOCK_SAMPLES;
+        int last = std::min(first + MESH_BLOCK_SAMPLES, splineSamples);
+        std::vector<glm::vec3> rings(3 * loopResolution);
+        glm::vec3 *prevRing = &rings[0];
+        glm::vec3 *ring = &rings[loopResolution];
+        glm::vec3 *nextRing = &rings[2 * loopResolution];
+        std::vector<glm::vec3> normalRows(4 * loopResolution);
+        glm::vec3 *prevNormals = &normalRows[0];   // Quads between the previous and current ring
+        glm::vec3 *nextNormals = &normalRows[2 * loopResolution];  // Quads between the current and next ring
+        std::vector<glm::vec3> ringNormals(averaged ? 0 : loopResolution);
+        std::vector<float> distAroundRing(loopResolution + 1);
+
+        // Start with the ring before the block, if any
+        if (averaged) {
+            if (first > 0) {
+                createRing(first - 1, prevRing, nullptr);
+            }
+            createRing(first, ring, nullptr);
+            if (first > 0) {
+                faceNormals(prevRing, ring, prevNormals);
+            }
+        }
+        for (int i = first; i < last; i++) {
+            bool hasPrev = i > 0;
+            bool hasNext = i < splineSamples - 1;
+            if (!averaged) {
+                createRing(i, ring, ringNormals.data());
+            }
+            else if (hasNext) {
+                createRing(i + 1, nextRing, nullptr);
+                faceNormals(ring, nextRing, nextNormals);
+            }
+
+            // Distance around the ring for texture coordinates
+            distAroundRing[0] = 0.0f;
+            for (int j = 1; j <= loopResolution; j++) {
+                distAroundRing[j] = distAroundRing[j - 1] + glm::distance(ring[j - 1], ring[j % loopResolution]);
+            }
+            float totalDist = distAroundRing[loopResolution];
+
+            // Vertices
+            MeshVertex *ringVertices = vertices + size_t(i) * (loopResolution + 1);
+            float u = targetLengths[i] / totalLength;
+            u = 0.999f * u + 0.0005f;
+            for (int j = 0; j <= loopResolution; j++) {
+                int ringIndex = j % loopResolution;
+                glm::vec3 normal;
+                if (averaged) {
+                    // Average the normals of all triangles that share this vertex
+                    int prevIndex = (ringIndex + loopResolution - 1) % loopResolution;
+                    normal = glm::vec3(0.0f);
+                    if (hasNext) {
+                        normal += nextNormals[2 * ringIndex];
+                        normal += nextNormals[2 * prevIndex] + nextNormals[2 * prevIndex + 1];
+                    }
+                    if (hasPrev) {
+                        normal += prevNormals[2 * ringIndex] + prevNormals[2 * ringIndex + 1];
+                        normal += prevNormals[2 * prevIndex + 1];
+                    }
+                    normal = glm::normalize(normal);
+                }
+                else {
+                    normal = ringNormals[ringIndex];
+                }
+
+                MeshVertex vertex;
+                vertex.position = ring[ringIndex];
+                vertex.normal = normal;
+                float v = distAroundRing[j] / totalDist;
+                v = 0.999f * v + 0.0005f;
+                vertex.texCoord = glm::vec2(u, v);
+                ringVertices[j] = vertex;
+            }
+
+            // Triangles between this ring and the next
+            if (hasNext) {
+                buildSplineMeshIndices(2, loopResolution, 1, indices + size_t(i) * loopResolution * 6,
+                        baseVertex + i * (loopResolution + 1));
+            }
+
+            // Advance
+            if (averaged) {
+                std::swap(prevRing, ring);
+                std::swap(ring, nextRing);
+                std::swap(prevNormals, nextNormals);
+            }
+        }
+    });
+}
+
+std::vector<float> addProfileSteps(BSpline& spline, const SplineProfiles& profiles, std::vector<float> targetLengths) {
+    // Place two rings close together at every jump, so that the shape changes over a short distance
+    float totalLength = spline.arcLength(1.0f);
+    float stepLength = std::min(PROFILE_STEP_LENGTH, 0.5f * totalLength / float(spline.spanCount()));
+    for (int span = 1; span < spline.spanCount(); span++) {
+        if (profiles.changesAt(span)) {
+            float s = spline.arcLength(float(span) / float(spline.spanCount()));
+            targetLengths.push_back(s - 0.5f * stepLength);
+            targetLengths.push_back(s + 0.5f * stepLength);
+        }
+    }
+    std::sort(targetLengths.begin(), targetLengths.end());
+    targetLengths.erase(std::unique(targetLengths.begin(), targetLengths.end()), targetLengths.end());
+    return targetLengths;
+}
+
+MeshData buildSplineMeshData(BSpline& spline, const std::vector<float>& targetLengths, const SplineProfiles& profiles, float radius, bool rotationMinimizingFrames,
+        MeshNormals normalMode, ThreadPool& pool) {
+    int loopResolution = profiles.getLoopResolution();
+    MeshData data;
+    data.vertices.resize(splineMeshVertexCount(targetLengths.size(), loopResolution));
+    data.indices.resize(splineMeshIndexCount(targetLengths.size(), loopResolution));
+    buildSplineMesh(spline, targetLengths, profiles, radius, rotationMinimizingFrames, normalMode, data.vertices.data(), data.indices.data(), 0, pool);
+    addSplineMeshChunks(data, 0, targetLengths.size(), loopResolution, { 0 });
+    return data;
+}
+
+MeshData buildNestedSplineMeshData(BSpline& spline, const std::vector<float>& coarseLengths, const SplineProfiles& profiles, int levels,
+        float radius, bool rotationMinimizingFrames, MeshNormals normalMode, ThreadPool& pool) {
+    int loopResolution = profiles.getLoopResolution();
+    int coarsestStep = 1 << (levels - 1);
+    assert(loopResolution % coarsestStep == 0);
+    std::vector<float> targetLengths = subdivideSampleLengths(coarseLengths, levels - 1);
+    int splineSamples = targetLengths.size();
+    spline.updateCaches();
+
+    // All levels go into one index buffer, finest first
+    MeshData data;
+    data.vertices.resize(splineMeshVertexCount(splineSamples, loopResolution));
+    size_t totalIndices = 0;
+    for (int level = 0; level < levels; level++) {
+        size_t indexCount = splineMeshIndexCount(splineSamples, loopResolution, 1 << level);
+        data.lods.push_back({ 0, (unsigned int)data.vertices.size(), (unsigned int)totalIndices, (unsigned int)indexCount });
+        totalIndices += indexCount;
+    }
+    data.indices.resize(totalIndices);
+
+    // The finest level creates the vertices, coarser levels only need indices
+    pool.parallelFor(levels, [&](int level) {
+        unsigned int *indices = &data.indices[data.lods[level].firstIndex];
+        if (level == 0) {
+            buildSplineMesh(spline, targetLengths, profiles, radius, rotationMinimizingFrames, normalMode, data.vertices.data(), indices, 0, pool);
+        }
+        else {
+            buildSplineMeshIndices(splineSamples, loopResolution, 1 << level, indices);
+        }
+    });
+    std::vector<unsigned int> firstIndices;
+    for (const MeshRange& range : data.lods) {
+        firstIndices.push_back(range.firstIndex);
+    }
+    addSplineMeshChunks(data, 0, splineSamples, loopResolution, firstIndices);
+    return data;
+}
+
+// Triangles between a ring of a spline mesh and the next one, where one ring uses every lowerStep-th and the other
+// every upperStep-th vertex. Each edge of the coarser ring is fanned to the vertices of the finer ring below it.
+static unsigned int *buildSplineMeshSeam(int loopResolution, int lowerRing, int lowerStep, int upperRing, int upperStep,
+        unsigned int *indices, unsigned int baseVertex) {
+    int coarseStep = std::max(lowerStep, upperStep);
+    int fineStep = std::min(lowerStep, upperStep);
+    unsigned int lower = baseVertex + lowerRing * (loopResolution + 1);
+    unsigned int upper = baseVertex + upperRing * (loopResolution + 1);
+    for (int j0 = 0; j0 < loopResolution; j0 += coarseStep) {
+        int j1 = j0 + coarseStep;
+        int mid = j0 + coarseStep / 2;
+        for (int j = j0; j < j1; j += fineStep) {
+            // Same winding as the quads of buildSplineMeshIndices
+            int corner = (j + fineStep <= mid) ? j0 : j1;
+            unsigned int triangle[3];
+            if (lowerStep == fineStep) {
+                triangle[0] = lower + j; triangle[1] = lower + j + fineStep; triangle[2] = upper + corner;
+            }
+            else {
+                triangle[0] = lower + corner; triangle[1] = upper + j + fineStep; triangle[2] = upper + j;
+            }
+            indices = std::copy(triangle, triangle + 3, indices);
+        }
+        unsigned int triangle[3];
+        if (lowerStep == fineStep) {
+            triangle[0] = lower + mid; triangle[1] = upper + j1; triangle[2] = upper + j0;
+        }
+        else {
+            triangle[0] = lower + j0; triangle[1] = lower + j1; triangle[2] = upper + mid;
+        }
+        indices = std::copy(triangle, triangle + 3, indices);
+    }
+    return indices;
+}
+
+void addSplineMeshChunks(MeshData& data, unsigned int firstVertex, int splineSamples, int loopResolution, const std::vector<unsigned int>& firstIndices) {
+    int levels = firstIndices.size();
+    assert(MESH_CHUNK_RINGS % (1 << (levels - 1)) == 0);
+    int ringVertices = loopResolution + 1;
+    for (int first = 0; first < splineSamples - 1; first += MESH_CHUNK_RINGS) {
+        int last = std::min(first + MESH_CHUNK_RINGS, splineSamples - 1);
+        MeshChunk chunk;
+        chunk.joinsPrevious = first > 0;
+
+        // Bounds of all rings of the chunk, which include those of the coarser levels
+        chunk.min = chunk.max = data.vertices[firstVertex + first * ringVertices].position;
+        for (int v = first * ringVertices; v < (last + 1) * ringVertices; v++) {
+            const glm::vec3& p = data.vertices[firstVertex + v].position;
+            chunk.min = glm::min(chunk.min, p);
+            chunk.max = glm::max(chunk.max, p);
+        }
+
+        // Indices are ordered by ring in every level, so each level of the chunk is one range
+        for (int level = 0; level < levels; level++) {
+            int step = 1 << level;
+            unsigned int ringIndices = (loopResolution / step) * 6;
+            chunk.ringIndexCounts.push_back(ringIndices);
+            chunk.lods.push_back({ firstVertex + first * ringVertices, (unsigned int)((last - first + 1) * ringVertices),
+                    firstIndices[level] + first / step * ringIndices, (last / step - first / step) * ringIndices });
+        }
+
+        // Error of each level, as the distance of the finest vertices from the triangles of the level that cover them
+        chunk.errors.assign(levels, 0.0f);
+        for (int level = 1; level < levels; level++) {
+            int step = 1 << level;
+            float error = chunk.errors[level - 1];
+            for (int i = first; i < last / step * step; i++) {
+                int i0 = i / step * step;
+                float u = float(i - i0) / float(step);
+                for (int j = 0; j < loopResolution; j++) {
+                    int j0 = j / step * step;
+                    float v = float(j - j0) / float(step);
+                    auto vertex = [&](int ring, int k) { return data.vertices[firstVertex + ring * ringVertices + k].position; };
+                    glm::vec3 p0 = vertex(i0, j0), p1 = vertex(i0, j0 + step), p2 = vertex(i0 + step, j0), p3 = vertex(i0 + step, j0 + step);
+                    glm::vec3 surface = (u + v <= 1.0f) ? p0 + v * (p1 - p0) + u * (p2 - p0)
+                                                         : p3 + (1.0f - v) * (p2 - p3) + (1.0f - u) * (p1 - p3);
+                    error = std::max(error, glm::length(vertex(i, j) - surface));
+                }
+            }
+            chunk.errors[level] = error;
+        }
+
+        // Seams to every coarser level on both sides. A level needs at least two rings apart from the seams.
+        chunk.seams.assign(levels * levels * 2, { 0, 0, 0, 0 });
+        for (int level = 0; level < levels; level++) {
+            int step = 1 << level;
+            if (last / step - first / step < 2) continue;
+            for (int neighbourLevel = level + 1; neighbourLevel < levels; neighbourLevel++) {
+                int neighbourStep = 1 << neighbourLevel;
+                for (int side = 0; side < 2; side++) {
+                    // Only where there is a neighbouring chunk
+                    if ((side == 0 && first == 0) || (side == 1 && last == splineSamples - 1)) continue;
+                    size_t firstIndex = data.indices.size();
+                    data.indices.resize(firstIndex + (loopResolution / neighbourStep) * (neighbourStep / step + 1) * 3);
+                    unsigned int *end = (side == 0)
+                        ? buildSplineMeshSeam(loopResolution, first, neighbourStep, first + step, step, &data.indices[firstIndex], firstVertex)
+                        : buildSplineMeshSeam(loopResolution, last - step, step, last, neighbourStep, &data.indices[firstIndex], firstVertex);
+                    assert(end == data.indices.data() + data.indices.size());
+                    chunk.seams[chunk.seamIndex(level, neighbourLevel, side)] = chunk.lods[level];
+                    chunk.seams[chunk.seamIndex(level, neighbourLevel, side)].firstIndex = firstIndex;
+                    chunk.seams[chunk.seamIndex(level, neighbourLevel, side)].indexCount = data.indices.size() - firstIndex;
+                }
+            }
+        }
+        data.chunks.push_back(chunk);
+    }
+}
+
+std::vector<float> subdivideSampleLengths(const std::vector<float>& targetLengths, int times) {
+    int parts = 1 << times;
+    std::vector<float> subdivided;
+    subdivided.reserve((targetLengths.size() - 1) * parts + 1);
+    for (size_t i = 0; i + 1 < targetLengths.size(); i++) {
+        for (int k = 0; k < parts; k++) {
+            subdivided.push_back(glm::mix(targetLengths[i], targetLengths[i + 1], float(k) / float(parts)));
+        }
+    }
+    subdivided.push_back(targetLengths.back());
+    return subdivided;
+}
+
+MeshData buildSplineMeshData(SplineSet& splines, const std::vector<std::vector<float>>& targetLengths, const std::vector<SplineProfiles>& profiles, float radius, bool rotationMinimizingFrames,
+        MeshNormals normalMode, ThreadPool& pool) {
+    // Exact size and location of each chain in the buffer
+    int nChains = splines.chainCount();
+    MeshData data;
+    data.ranges.resize(nChains);
+    size_t totalVertices = 0, totalIndices = 0;
+    for (int c = 0; c < nChains; c++) {
+        int loopResolution = profiles[c].getLoopResolution();
+        size_t vertexCount = splineMeshVertexCount(targetLengths[c].size(), loopResolution);
+        size_t indexCount = splineMeshIndexCount(targetLengths[c].size(), loopResolution);
+        data.ranges[c] = { (unsigned int)totalVertices, (unsigned int)vertexCount,
+                           (unsigned int)totalIndices, (unsigned int)indexCount };
+        totalVertices += vertexCount;
+        totalIndices += indexCount;
+    }
+
+    // Build each chain straight into its part of the buffer
+    data.vertices.resize(totalVertices);
+    data.indices.resize(totalIndices);
+    pool.parallelFor(nChains, [&](int c) {
+        const MeshRange& range = data.ranges[c];
+        buildSplineMesh(splines.chain(c), targetLengths[c], profiles[c], radius, rotationMinimizingFrames, normalMode,
+                &data.vertices[range.firstVertex], &data.indices[range.firstIndex], range.firstVertex, pool);
+    });
+    for (int c = 0; c < nChains; c++) {
+        const MeshRange& range = data.ranges[c];
+        addSplineMeshChunks(data, range.firstVertex, targetLengths[c].size(), profiles[c].getLoopResolution(), { range.firstIndex });
+    }
+    return data;
+}
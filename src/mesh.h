@@ -0,0 +1,100 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "spline.h"
+#include "profile.h"
+#include "parallel.h"
+
+// Spline meshes on the CPU. Building them needs no GL context, see Mesh in gl.h for uploading and drawing.
+
+struct MeshVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoord;
+};
+
+// Part of a mesh, e.g. a single spline chain
+struct MeshRange {
+    unsigned int firstVertex;
+    unsigned int vertexCount;
+    unsigned int firstIndex;
+    unsigned int indexCount;
+};
+
+// Run of rings of a spline mesh with its bounds, so that it can be culled
+struct MeshChunk {
+    glm::vec3 min;
+    glm::vec3 max;
+    // Whether the chunk continues the surface of the previous one, i.e. both are part of the same spline
+    bool joinsPrevious;
+    // Index range of the chunk in each level of detail, or a single range if the mesh has no levels
+    std::vector<MeshRange> lods;
+    // Largest distance of each level from the vertices of the finest level
+    std::vector<float> errors;
+    // Number of indices between two consecutive rings of each level
+    std::vector<unsigned int> ringIndexCounts;
+    // Triangles that replace the first (side 0) or last (side 1) rings of a level, to close the gap to a coarser
+    // neighbour without cracks. Indexed by seamIndex, empty where the neighbour is not coarser.
+    std::vector<MeshRange> seams;
+
+    int seamIndex(int level, int neighbourLevel, int side) const {
+        return (level * int(lods.size()) + neighbourLevel) * 2 + side;
+    }
+};
+
+// Vertices and indices of a mesh before it is uploaded.
+// Unlike Mesh, which needs the GL context, this can be built on any thread.
+struct MeshData {
+    std::vector<MeshVertex> vertices;
+    std::vector<unsigned int> indices;
+    // Vertex and index ranges of the parts this mesh was built from, if any
+    std::vector<MeshRange> ranges;
+    // Index ranges of nested levels of detail over the shared vertices, finest first, if any
+    std::vector<MeshRange> lods;
+    // Chunks of spline meshes, if any
+    std::vector<MeshChunk> chunks;
+};
+
+// How vertex normals of spline meshes are computed
+enum class MeshNormals {
+    Averaged,         // Average of the normals of the surrounding triangles
+    Analytic,         // Normal of the cross-section profile placed in the frame, so every vertex is independent
+    AnalyticStretch,  // Same, tilted along the tangent where curvature or a changing profile stretch the surface
+};
+
+// Build a spline mesh with rings at the given arc lengths straight into caller-provided memory, e.g. a mapped GL buffer
+// or part of a larger array. vertices and indices need room for exactly splineMeshVertexCount and splineMeshIndexCount
+// entries, and are only written to. Indices are offset by baseVertex. Rings take the cross-section of the span
+// they lie in, scaled by radius.
+size_t splineMeshVertexCount(int splineSamples, int loopResolution);
+size_t splineMeshIndexCount(int splineSamples, int loopResolution, int step = 1);
+// Work is split into blocks of samples that run on the given thread pool, and the output is the same for any number of threads.
+// Spline caches are brought up to date before the parallel work starts, so the spline must not be used by other threads
+// during the build, e.g. to build a second mesh of it at the same time.
+void buildSplineMesh(BSpline& spline, const std::vector<float>& targetLengths, const SplineProfiles& profiles, float radius, bool rotationMinimizingFrames,
+        MeshNormals normalMode, MeshVertex *vertices, unsigned int *indices, unsigned int baseVertex = 0,
+        ThreadPool& pool = ThreadPool::global());
+// Same, into new exactly sized buffers. For sets, chains are sampled at the given arc lengths and built in parallel into one buffer.
+MeshData buildSplineMeshData(BSpline& spline, const std::vector<float>& targetLengths, const SplineProfiles& profiles, float radius, bool rotationMinimizingFrames,
+        MeshNormals normalMode, ThreadPool& pool = ThreadPool::global());
+MeshData buildSplineMeshData(SplineSet& splines, const std::vector<std::vector<float>>& targetLengths, const std::vector<SplineProfiles>& profiles, float radius, bool rotationMinimizingFrames,
+        MeshNormals normalMode, ThreadPool& pool = ThreadPool::global());
+// Build nested levels of detail into one mesh. Level k uses every 2^k-th ring and every 2^k-th vertex around each ring
+// of the finest level, so all levels share one vertex buffer and only differ in their index ranges. coarseLengths are the
+// sample arc lengths of the coarsest level, which are subdivided for the finer ones. The loop resolution of the profiles
+// is that of the finest level, and must be divisible by 2^(levels - 1).
+MeshData buildNestedSplineMeshData(BSpline& spline, const std::vector<float>& coarseLengths, const SplineProfiles& profiles, int levels,
+        float radius, bool rotationMinimizingFrames, MeshNormals normalMode, ThreadPool& pool = ThreadPool::global());
+// Split a spline mesh part into chunks of MESH_CHUNK_RINGS rings and compute their bounds, the error of each level and
+// the seams between levels. The part starts at firstVertex, and its indices of level k (every 2^k-th ring and vertex,
+// see buildSplineMeshIndices) start at firstIndices[k]. Seam indices are appended to the mesh.
+void addSplineMeshChunks(MeshData& data, unsigned int firstVertex, int splineSamples, int loopResolution, const std::vector<unsigned int>& firstIndices);
+// Indices of the quads between every step-th ring of a spline mesh, using every step-th vertex around each ring
+void buildSplineMeshIndices(int splineSamples, int loopResolution, int step, unsigned int *indices, unsigned int baseVertex = 0);
+// Insert 2^times - 1 evenly spaced samples into every interval
+std::vector<float> subdivideSampleLengths(const std::vector<float>& targetLengths, int times);
+// Add sample arc lengths where the profile changes between spans, so that the change is sharp
+std::vector<float> addProfileSteps(BSpline& spline, const SplineProfiles& profiles, std::vector<float> targetLengths);
+// Evenly spaced arc lengths from start to end of the spline
+std::vector<float> uniformSampleLengths(BSpline& spline, int splineSamples);
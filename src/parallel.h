@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run parallel loops.
+// The calling thread always helps with its own loop, so loops may be nested (e.g. chains inside LODs)
+// without deadlocking, even when all workers are busy with outer loops.
+class ThreadPool {
+private:
+    // One parallel loop, shared between the caller and any workers that pick it up
+    struct Job {
+        const std::function<void(int)> *f;
+        int n;
+        std::atomic<int> next { 0 };
+        std::atomic<int> done { 0 };
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<std::shared_ptr<Job>> jobs;
+    std::mutex mutex;
+    std::condition_variable jobAdded;
+    std::condition_variable jobDone;
+    bool stopping = false;
+
+    // Claim and run items of a job until none are left
+    void work(Job& job) {
+        for (int i = job.next++; i < job.n; i = job.next++) {
+            (*job.f)(i);
+            if (++job.done == job.n) {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobDone.notify_all();
+            }
+        }
+    }
+
+    // Remove a job whose items have all been claimed
+    void retire(const std::shared_ptr<Job>& job) {
+        auto it = std::find(jobs.begin(), jobs.end(), job);
+        if (it != jobs.end()) jobs.erase(it);
+    }
+
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            jobAdded.wait(lock, [&]() { return stopping || !jobs.empty(); });
+            if (stopping) return;
+            std::shared_ptr<Job> job = jobs.front();
+            lock.unlock();
+            work(*job);
+            lock.lock();
+            retire(job);
+        }
+    }
+
+public:
+    ThreadPool(int nThreads) {
+        for (int t = 0; t < nThreads; t++) {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        jobAdded.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    int threadCount() const {
+        return workers.size() + 1;
+    }
+
+    // Call f(i) for every i in [0, n) and wait until all calls have finished.
+    // Items are handed out one at a time, so they may differ in cost.
+    void parallelFor(int n, const std::function<void(int)>& f) {
+        if (n <= 0) return;
+        if (n == 1 || workers.empty()) {
+            for (int i = 0; i < n; i++) {
+                f(i);
+            }
+            return;
+        }
+
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+        job->f = &f;
+        job->n = n;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        jobAdded.notify_all();
+
+        work(*job);
+
+        // Wait for items still running on workers
+        std::unique_lock<std::mutex> lock(mutex);
+        retire(job);
+        jobDone.wait(lock, [&]() { return job->done == n; });
+    }
+
+    // Pool shared by the whole program, with one thread per hardware thread
+    static ThreadPool& global() {
+        static ThreadPool pool(int(std::max(std::thread::hardware_concurrency(), 1u)) - 1);
+        return pool;
+    }
+};
+
+// Call f(i) for every i in [0, n) on the global thread pool
+template <typename F>
+void parallelFor(int n, F f) {
+    ThreadPool::global().parallelFor(n, std::function<void(int)>(f));
+}
@@ -0,0 +1,107 @@
+#include "profile.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+CrossSectionProfile::CrossSectionProfile(ProfileShape shape, int loopResolution, float width, float thickness)
+    : shape(shape), points(loopResolution), normals(loopResolution) {
+    int half = loopResolution / 2;
+    for (int j = 0; j < loopResolution; j++) {
+        float angle = 2.0f * M_PI * float(j) / float(loopResolution);
+        float d = glm::sin(angle);
+        float n = glm::cos(angle);
+
+        switch (shape) {
+            case ProfileShape::Tube:
+                d *= width;
+                n *= width;
+                break;
+            case ProfileShape::FlatRibbon:
+            case ProfileShape::ArrowHead:
+                // Capped circle
+                d = glm::clamp(d, -thickness, thickness);
+                n *= width;
+                break;
+            case ProfileShape::Rectangle: {
+                // Rectangular with dull edge, even spacing
+                assert(loopResolution % 2 == 0 && half >= 2);
+                int a = j % half;
+                d = (a == 0) ? 0.0f : thickness;
+                n = -((a / (half - 1.0f)) * 2.0f - 1.0f) * width;
+                if (j >= half) {
+                    d *= -1.0f;
+                    n *= -1.0f;
+                }
+                break;
+            }
+        }
+        points[j] = glm::vec2(d, n);
+    }
+
+    // Arrow heads narrow to a point at the end of the span
+    if (shape == ProfileShape::ArrowHead) {
+        scaleEnd = glm::vec2(1.0f, 0.2f);
+    }
+
+    // Vertex normals average the normals of both neighbouring edges.
+    // Points go clockwise, so outward edge normals point to the left of the edges.
+    for (int j = 0; j < loopResolution; j++) {
+        glm::vec2 prev = points[(j + loopResolution - 1) % loopResolution];
+        glm::vec2 next = points[(j + 1) % loopResolution];
+        glm::vec2 e0 = points[j] - prev;
+        glm::vec2 e1 = next - points[j];
+        glm::vec2 n0 = glm::vec2(-e0.y, e0.x);
+        glm::vec2 n1 = glm::vec2(-e1.y, e1.x);
+        float l0 = glm::length(n0);
+        float l1 = glm::length(n1);
+        glm::vec2 normal = (l0 > 0.0f ? n0 / l0 : glm::vec2(0.0f)) + (l1 > 0.0f ? n1 / l1 : glm::vec2(0.0f));
+        normals[j] = (glm::length(normal) > 0.0f) ? glm::normalize(normal) : glm::normalize(points[j]);
+    }
+}
+
+SplineProfiles::SplineProfiles(int loopResolution, int spanCount)
+    : loopResolution(loopResolution), spanProfiles(spanCount, 0) {
+    addProfile(ProfileShape::FlatRibbon);
+}
+
+int SplineProfiles::addProfile(const CrossSectionProfile& profile) {
+    assert(int(profile.points.size()) == loopResolution);
+    profiles.push_back(profile);
+    return profiles.size() - 1;
+}
+
+int SplineProfiles::addProfile(ProfileShape shape, float width, float thickness) {
+    return addProfile(CrossSectionProfile(shape, loopResolution, width, thickness));
+}
+
+void SplineProfiles::assign(int first, int last, int profile) {
+    assert(profile >= 0 && profile < int(profiles.size()));
+    first = std::max(first, 0);
+    last = std::min(last, spanCount() - 1);
+    for (int span = first; span <= last; span++) {
+        spanProfiles[span] = profile;
+    }
+}
+
+bool SplineProfiles::changesAt(int span) const {
+    if (span <= 0 || span >= spanCount()) return false;
+    const CrossSectionProfile& a = spanProfile(span - 1);
+    const CrossSectionProfile& b = spanProfile(span);
+    return spanProfiles[span - 1] != spanProfiles[span] || a.scaleEnd != b.scaleStart;
+}
+
+SplineProfiles exampleProfiles(int spanCount, int loopResolution) {
+    SplineProfiles profiles(loopResolution, spanCount);
+    int coil = profiles.addProfile(ProfileShape::FlatRibbon, 0.25f);
+    int sheet = profiles.addProfile(ProfileShape::FlatRibbon, 0.5f);
+    int arrow = profiles.addProfile(ProfileShape::ArrowHead, 1.25f);
+
+    // Thin start, then a few short sheets with arrows, then the default ribbon
+    profiles.assign(0, 1, coil);
+    for (int span = 2; span < 12; span += 2) {
+        profiles.assign(span, span, sheet);
+        profiles.assign(span + 1, span + 1, arrow);
+    }
+
+    return profiles;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Shapes of spline mesh cross-sections
+enum class ProfileShape {
+    Tube,        // Circle
+    FlatRibbon,  // Circle capped to a thin band, with pointed edges
+    Rectangle,   // Thin rectangle with dull edges
+    ArrowHead,   // Flat ribbon that narrows along the span
+};
+
+// Cross-section of a spline mesh, precomputed for one loop resolution.
+// Points and outward normals are 2D in the frame of the spline, with x along the binormal and y along the normal.
+// Along a span, the shape is scaled from scaleStart at its start to scaleEnd at its end.
+struct CrossSectionProfile {
+    ProfileShape shape;
+    std::vector<glm::vec2> points;
+    std::vector<glm::vec2> normals;
+    glm::vec2 scaleStart = glm::vec2(1.0f);
+    glm::vec2 scaleEnd = glm::vec2(1.0f);
+
+    // Width is the extent along y, thickness the extent of flat shapes along x (both from the center)
+    CrossSectionProfile(ProfileShape shape, int loopResolution, float width = 1.0f, float thickness = 0.125f);
+
+    // Scale at fraction f (0 to 1) along a span
+    glm::vec2 scale(float f) const {
+        return glm::mix(scaleStart, scaleEnd, f);
+    }
+};
+
+// Library of cross-section profiles with an assignment of profiles to the knot spans of a spline,
+// so that e.g. helices, sheets with arrow heads and coils can be mixed in one mesh.
+// All profiles share one loop resolution, and each is only computed once.
+class SplineProfiles {
+private:
+    int loopResolution;
+    std::vector<CrossSectionProfile> profiles;
+    // Profile index of each span
+    std::vector<int> spanProfiles;
+
+public:
+    // Profiles for a spline with the given number of spans (see BSpline::spanCount).
+    // All spans start out with a flat ribbon, which is profile 0.
+    SplineProfiles(int loopResolution, int spanCount);
+
+    // Add a profile to the library and return its index
+    int addProfile(const CrossSectionProfile& profile);
+    int addProfile(ProfileShape shape, float width = 1.0f, float thickness = 0.125f);
+
+    // Use a profile for spans first to last (inclusive)
+    void assign(int first, int last, int profile);
+
+    // Getters
+    int getLoopResolution() const {
+        return loopResolution;
+    }
+    int spanCount() const {
+        return spanProfiles.size();
+    }
+    int profileCount() const {
+        return profiles.size();
+    }
+    const CrossSectionProfile& getProfile(int profile) const {
+        return profiles[profile];
+    }
+    int profileIndex(int span) const {
+        return spanProfiles[span];
+    }
+    const CrossSectionProfile& spanProfile(int span) const {
+        return profiles[spanProfiles[span]];
+    }
+
+    // Whether the cross-section jumps between the end of span - 1 and the start of span
+    bool changesAt(int span) const;
+};
+
+// For testing; profiles in the style of a protein cartoon for the example spline
+SplineProfiles exampleProfiles(int spanCount, int loopResolution);
@@ -1,4 +1,5 @@
 #version 330 core
+// Compiled per CYLINDER_MODE and CUT_PLANES, see cylinder_vertex.glsl
 out vec4 FragColor;
 
 in vec3 fPos;
@@ -6,25 +7,44 @@ in vec3 fCol;
 in vec3 fA;
 in vec3 fB;
 in vec3 fStartDir;
+#if CUT_PLANES
 in vec3 fACPN;
 in vec3 fBCPN;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-uniform vec3 lightPos;
-uniform float lightIntensity;
-uniform float ambientLightIntensity;
-uniform int drawNormals;
-uniform float cylinderRadius;
+#endif
+
+// Per-frame transforms, shared by all programs (see TransformBlock)
+layout (std140) uniform Transforms {
+    mat4 modelView;
+    mat4 projection;
+    mat4 normalMatrix; // Upper 3x3 is the inverse transpose of modelView
+    vec4 viewUp;
+};
+
+// Draw settings, shared by all programs (see ParameterBlock)
+layout (std140) uniform Parameters {
+    vec3 lightPos;
+    float lightIntensity;
+    float ambientLightIntensity;
+    float sphereRadius;
+    float cylinderRadius;
+    float pitch;
+    float width;
+    int drawNormals;
+    int drawTexture;
+    int checkerboard;
+    int raytraced;
+};
 uniform int distortionCorrection;
-uniform int cylinderMode;
-uniform float pitch;
-uniform float width;
 
 #define PI 3.1415926538
 
+// Whether a point on the axis line is cut off at either end, by the cut planes or by the ends of the segment
+#if CUT_PLANES
+#define OUTSIDE_ENDS(pos, ct) (dot((pos) - a, fACPN) < 0.0 || dot(b - (pos), fBCPN) < 0.0)
+#else
+#define OUTSIDE_ENDS(pos, ct) ((ct) < 0.0 || (ct) > 1.0)
+#endif
+
 void main() {
     vec3 a = fA;
     vec3 b = fB;
@@ -51,7 +71,8 @@ void main() {
     vec3 p = a + ct * ab; // p is the hit point projected onto the center axis of the cylinder
     vec3 normal = normalize(pos - p);
 
-    if (cylinderMode == 2) { // Helix
+#if CYLINDER_MODE == 2 // Helix
+    {
         float nTurns = length(ab) / pitch;
         float angle = nTurns * ct * 2.0 * PI;
         vec3 helixX = normalize(fStartDir);
@@ -59,14 +80,13 @@ void main() {
         vec3 helixDir = helixX * cos(angle) + helixY * sin(angle);
 
         // Check if outside is hit
-        // If not using CPNs, check if 0 <= ct <= 1
-        if (dot(pos - a, fACPN) < 0.0 || dot(b - pos, fBCPN) < 0.0 || 1.0 - dot(normal, helixDir) > 2.0 * width) {
+        if (OUTSIDE_ENDS(pos, ct) || 1.0 - dot(normal, helixDir) > 2.0 * width) {
             // Outside not hit; check if inside is hit
             pos = max(t0, t1) * d;
             ap = pos - a;
             ct = dot(ab, ap) / dot(ab, ab);
 
-            if (dot(pos - a, fACPN) < 0.0 || dot(b - pos, fBCPN) < 0.0) discard;
+            if (OUTSIDE_ENDS(pos, ct)) discard;
 
             p = a + ct * ab;
             normal = normalize(pos - p);
@@ -83,7 +103,8 @@ void main() {
             normal = -normal;
         }
     }
-    else if (cylinderMode == 1) { // Sphere caps
+#elif CYLINDER_MODE == 1 // Sphere caps
+    {
         if (ct < 0.0 || ct > 1.0) {
             // Raytrace a sphere endcap
             vec3 s;
@@ -103,11 +124,11 @@ void main() {
             normal = normalize(pos - s);
         }
     }
-    else { // Simple cylinder
-        if (dot(pos - a, fACPN) < 0.0 || dot(b - pos, fBCPN) < 0.0) {
-            discard;
-        }
+#else // Simple cylinder
+    if (OUTSIDE_ENDS(pos, ct)) {
+        discard;
     }
+#endif
 
     if (drawNormals != 0) {
         // Color fragment based on normal
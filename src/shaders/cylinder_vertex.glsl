@@ -1,15 +1,33 @@
 #version 330 core
-layout (location = 0) in vec3 in_aPos;
-layout (location = 1) in vec3 in_bPos;
-layout (location = 2) in vec3 in_aCutPlaneNormal;
-layout (location = 3) in vec3 in_bCutPlaneNormal;
-layout (location = 4) in vec3 in_startDir;
+// Compiled once per combination of (see Shaders::cylinderProgram):
+// CYLINDER_MODE: 0 for simple cylinders, 1 for rounded caps, 2 for ribbon helices
+// CUT_PLANES: 1 to cut the ends with the planes between neighbouring bonds so that chains join without gaps (18 vertices),
+//             0 for ends perpendicular to the axis, where only the cap that faces the camera is needed (12 vertices)
+// Per instance: indices of the atom before A, A, B and the atom after B, or -1 (see CylinderBond)
+layout (location = 0) in ivec4 aBond;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform float cylinderRadius;
-uniform int cylinderMode;
+// Per-frame transforms, shared by all programs (see TransformBlock)
+layout (std140) uniform Transforms {
+    mat4 modelView;
+    mat4 projection;
+    mat4 normalMatrix; // Upper 3x3 is the inverse transpose of modelView
+    vec4 viewUp;
+};
+// Draw settings, shared by all programs (see ParameterBlock)
+layout (std140) uniform Parameters {
+    vec3 lightPos;
+    float lightIntensity;
+    float ambientLightIntensity;
+    float sphereRadius;
+    float cylinderRadius;
+    float pitch;
+    float width;
+    int drawNormals;
+    int drawTexture;
+    int checkerboard;
+    int raytraced;
+};
+uniform samplerBuffer atoms; // Position and radius of each atom
 
 out vec3 fPos;
 out vec3 fCol;
@@ -18,8 +36,10 @@ out vec3 fOrigin;
 out vec3 fA;
 out vec3 fB;
 out vec3 fStartDir;
+#if CUT_PLANES
 out vec3 fACPN;
 out vec3 fBCPN;
+#endif
 
 vec3 OFFSETS[18] = vec3[](
     // A cap
@@ -54,15 +74,42 @@ vec3 BARYCENTRIC[6] = vec3[](
     vec3(1.0, 0.0, 0.0)
 );
 
+vec3 atomPosition(int i) {
+    return texelFetch(atoms, i).xyz;
+}
+
 void main() {
-    int vID = gl_VertexID % 18;
+    int vID = gl_VertexID;
+
+    // Endpoints
+    vec3 in_aPos = atomPosition(aBond.y);
+    vec3 in_bPos = atomPosition(aBond.z);
+    // TODO Compute meaningful value for startDir
+    //      It should be perpendicular to the cylinder axis!
+    //      Currently this will produce artifacts if a cylinder is pointing in the x direction
+    vec3 in_startDir = vec3(1.0, 0.0, 0.0);
 
     vec3 viewPos = vec3(0.0);
-    vec3 aPos = vec3(view * model * vec4(in_aPos, 1.0));
-    vec3 bPos = vec3(view * model * vec4(in_bPos, 1.0));
-    vec3 aCPN = normalize(transpose(inverse(mat3(view * model))) * in_aCutPlaneNormal);
-    vec3 bCPN = normalize(transpose(inverse(mat3(view * model))) * in_bCutPlaneNormal);
+    vec3 aPos = vec3(modelView * vec4(in_aPos, 1.0));
+    vec3 bPos = vec3(modelView * vec4(in_bPos, 1.0));
     vec3 v = 0.5 * (bPos - aPos);
+#if CUT_PLANES
+    // Cut planes that halve the angle to the neighbouring bonds
+    vec3 axis = normalize(in_bPos - in_aPos);
+    vec3 in_aCutPlaneNormal = axis;
+    vec3 in_bCutPlaneNormal = axis;
+    if (aBond.x >= 0) {
+        in_aCutPlaneNormal = normalize(axis - normalize(atomPosition(aBond.x) - in_aPos));
+    }
+    if (aBond.w >= 0) {
+        in_bCutPlaneNormal = normalize(normalize(atomPosition(aBond.w) - in_bPos) + axis);
+    }
+    vec3 aCPN = normalize(mat3(normalMatrix) * in_aCutPlaneNormal);
+    vec3 bCPN = normalize(mat3(normalMatrix) * in_bCutPlaneNormal);
+#else
+    vec3 aCPN = normalize(v);
+    vec3 bCPN = aCPN;
+#endif
     vec3 centerPos = aPos + v;
     vec3 u = -normalize(cross(v, centerPos - viewPos)) * cylinderRadius;
     vec3 w = normalize(cross(u, v));
@@ -70,18 +117,20 @@ void main() {
     // Propagate endpoints and cut plane normals to fragment shader
     fA = vec3(vec4(aPos, 1.0));
     fB = vec3(vec4(bPos, 1.0));
+#if CUT_PLANES
     fACPN = aCPN;
     fBCPN = bCPN;
+#endif
 
     vec3 coords = OFFSETS[vID];
 
-    // Render cap quad that is closer to camera
-    // NOTE This optimization allows for only 12 vertices per impostor instead of 18
-    //      But we can't do it for the general case because cut planes could both face the camera
-    //      Could do this for helices though
-    //if (dot(centerPos - viewPos, v) < 0.0) {
-    //    coords.xy *= -1.0;
-    //}
+#if !CUT_PLANES
+    // Only draw the A cap and the main quad, and turn them around when the B cap is closer to the camera.
+    // NOTE This needs ends perpendicular to the axis, cut planes could both face the camera.
+    if (dot(centerPos - viewPos, v) < 0.0) {
+        coords.xy *= -1.0;
+    }
+#endif
 
     // Calculate vertex position for simple cylinder
     //vec3 pos = centerPos + u * coords.x + v * coords.y + w * coords.z * cylinderRadius;
@@ -100,11 +149,13 @@ void main() {
     pos = pos + d * normalize(v);
 
     // Extend bounds if drawing sphere end caps
-    if (cylinderMode == 1) pos += coords.y * normalize(v) * cylinderRadius;
+#if CYLINDER_MODE == 1
+    pos += coords.y * normalize(v) * cylinderRadius;
+#endif
 
     gl_Position = projection * vec4(pos, 1.0);
     fPos = pos;
     fCol = vec3(1.0);
     bCoord = BARYCENTRIC[vID % 6];
-    fStartDir = normalize(transpose(inverse(mat3(view * model))) * in_startDir);
+    fStartDir = normalize(mat3(normalMatrix) * in_startDir);
 }
@@ -6,14 +6,20 @@ in vec3 fNorm;
 in vec2 fTexCoord;
 in vec3 fCol;
 
-uniform mat4 view;
-
-uniform vec3 lightPos;
-uniform float lightIntensity;
-uniform float ambientLightIntensity;
-uniform int drawNormals;
-uniform int drawTexture;
-uniform int checkerboard;
+// Draw settings, shared by all programs (see ParameterBlock)
+layout (std140) uniform Parameters {
+    vec3 lightPos;
+    float lightIntensity;
+    float ambientLightIntensity;
+    float sphereRadius;
+    float cylinderRadius;
+    float pitch;
+    float width;
+    int drawNormals;
+    int drawTexture;
+    int checkerboard;
+    int raytraced;
+};
 uniform sampler2D lightmap;
 
 void main() {
@@ -2,10 +2,20 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNorm;
 layout (location = 2) in vec2 aTexCoord;
+// Packed vertices, see PackedMeshVertex
+layout (location = 3) in uvec4 aPackedPos; // Position in the chunk bounds, and chunk index
+layout (location = 4) in vec2 aPackedNorm; // Octahedral normal
+layout (location = 5) in vec2 aPackedTexCoord;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per-frame transforms, shared by all programs (see TransformBlock)
+layout (std140) uniform Transforms {
+    mat4 modelView;
+    mat4 projection;
+    mat4 normalMatrix; // Upper 3x3 is the inverse transpose of modelView
+    vec4 viewUp;
+};
+// PACKED_VERTICES is defined by the program, see Shaders::meshProgram
+uniform samplerBuffer chunkBounds; // Minimum and extent of each chunk
 
 out vec3 fPos;
 out vec3 fNorm;
@@ -19,13 +29,32 @@ vec3 BARYCENTRIC[3] = vec3[](
     vec3(0.0, 1.0, 0.0)
 );
 
+vec3 octahedralDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
 void main() {
-    vec4 pos = projection * view * model * vec4(aPos, 1.0);
-    vec3 vPos = vec3(view * model * vec4(aPos, 1.0));
-    gl_Position = pos;
+    vec3 position = aPos;
+    vec3 normal = aNorm;
+    vec2 texCoord = aTexCoord;
+#if PACKED_VERTICES
+    int chunk = int(aPackedPos.w);
+    vec3 minimum = texelFetch(chunkBounds, 2 * chunk).xyz;
+    vec3 extent = texelFetch(chunkBounds, 2 * chunk + 1).xyz;
+    position = minimum + extent * (vec3(aPackedPos.xyz) / 65535.0);
+    normal = octahedralDecode(aPackedNorm);
+    texCoord = aPackedTexCoord;
+#endif
+
+    vec3 vPos = vec3(modelView * vec4(position, 1.0));
+    gl_Position = projection * vec4(vPos, 1.0);
     fPos = vPos;
-    fNorm = normalize(transpose(inverse(mat3(view * model))) * aNorm);
-    fTexCoord = aTexCoord;
+    fNorm = normalize(mat3(normalMatrix) * normal);
+    fTexCoord = texCoord;
     fCol = vec3(1.0);
     bCoord = BARYCENTRIC[gl_VertexID % 3];
 }
@@ -6,17 +6,30 @@ in vec3 fNorm;
 in vec3 fCol;
 in vec2 fCoord;
 in vec3 fOrigin;
+flat in float fRadius;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per-frame transforms, shared by all programs (see TransformBlock)
+layout (std140) uniform Transforms {
+    mat4 modelView;
+    mat4 projection;
+    mat4 normalMatrix; // Upper 3x3 is the inverse transpose of modelView
+    vec4 viewUp;
+};
 
-uniform vec3 lightPos;
-uniform float lightIntensity;
-uniform float ambientLightIntensity;
-uniform int drawNormals;
-uniform float sphereRadius;
-uniform int raytraced;
+// Draw settings, shared by all programs (see ParameterBlock)
+layout (std140) uniform Parameters {
+    vec3 lightPos;
+    float lightIntensity;
+    float ambientLightIntensity;
+    float sphereRadius;
+    float cylinderRadius;
+    float pitch;
+    float width;
+    int drawNormals;
+    int drawTexture;
+    int checkerboard;
+    int raytraced;
+};
 
 void main() {
     vec3 pos;
@@ -28,7 +41,7 @@ void main() {
         vec3 s = fOrigin;
         float a = 1.0;
         float b = -2.0 * dot(d, s);
-        float c = dot(s, s) - sphereRadius * sphereRadius;
+        float c = dot(s, s) - fRadius * fRadius;
         float discriminant = b * b - 4.0 * a * c;
         if (discriminant < 0.0) {
             discard;
@@ -45,7 +58,7 @@ void main() {
         if (distSqr > 1.0) {
             discard;
         }
-        pos = fPos + fNorm * sqrt(1.0 - distSqr) * sphereRadius;
+        pos = fPos + fNorm * sqrt(1.0 - distSqr) * fRadius;
         normal = normalize(pos - fOrigin);
     }
 
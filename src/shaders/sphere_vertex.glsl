@@ -1,11 +1,30 @@
 #version 330 core
+// Per instance, see SphereInstance
 layout (location = 0) in vec3 aPos;
+layout (location = 1) in float aRadius;
+layout (location = 2) in vec4 aColor;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform float sphereRadius;
-uniform int raytraced;
+// Per-frame transforms, shared by all programs (see TransformBlock)
+layout (std140) uniform Transforms {
+    mat4 modelView;
+    mat4 projection;
+    mat4 normalMatrix; // Upper 3x3 is the inverse transpose of modelView
+    vec4 viewUp;
+};
+// Draw settings, shared by all programs (see ParameterBlock)
+layout (std140) uniform Parameters {
+    vec3 lightPos;
+    float lightIntensity;
+    float ambientLightIntensity;
+    float sphereRadius;
+    float cylinderRadius;
+    float pitch;
+    float width;
+    int drawNormals;
+    int drawTexture;
+    int checkerboard;
+    int raytraced;
+};
 
 out vec3 fPos;
 out vec3 fNorm;
@@ -13,43 +32,43 @@ out vec3 fCol;
 out vec2 fCoord;
 out vec3 bCoord; // Barycentric coordinates, for wireframe shader
 out vec3 fOrigin;
+flat out float fRadius;
 
-vec2 OFFSETS[6] = vec2[](
+// Corners of the quad, as a triangle strip
+vec2 OFFSETS[4] = vec2[](
     vec2(-1.0, -1.0),
     vec2( 1.0, -1.0),
     vec2(-1.0,  1.0),
-    vec2( 1.0,  1.0),
-    vec2(-1.0,  1.0),
-    vec2( 1.0, -1.0)
+    vec2( 1.0,  1.0)
 );
 
-vec3 BARYCENTRIC[6] = vec3[](
-    vec3(0.0, 0.0, 1.0),
+// The second triangle of the strip is (1, 2, 3)
+vec3 BARYCENTRIC[4] = vec3[](
     vec3(1.0, 0.0, 0.0),
     vec3(0.0, 1.0, 0.0),
     vec3(0.0, 0.0, 1.0),
-    vec3(0.0, 1.0, 0.0),
     vec3(1.0, 0.0, 0.0)
 );
 
 void main() {
-    int vID = gl_VertexID % 6;
+    int vID = gl_VertexID;
+    float radius = aRadius * sphereRadius;
 
     vec3 viewPos = vec3(0.0);
-    vec3 originPos = vec3(view * model * vec4(aPos, 1.0));
+    vec3 originPos = vec3(modelView * vec4(aPos, 1.0));
     vec3 normal = normalize(viewPos - originPos);
-    vec3 viewUp = normalize(transpose(inverse(mat3(view))) * vec3(0.0, 1.0, 0.0));
-    vec3 u = normalize(cross(normal, viewUp));
+    vec3 u = normalize(cross(normal, viewUp.xyz));
     vec3 v = cross(normal, u);
     vec2 coords = OFFSETS[vID];
-    vec3 pos = originPos + coords.x * sphereRadius * u + coords.y * sphereRadius * v;
-    if (raytraced != 0) pos += 0.25 * sphereRadius * normal; // Avoid clipping due to perspective distortion
+    vec3 pos = originPos + coords.x * radius * u + coords.y * radius * v;
+    if (raytraced != 0) pos += 0.25 * radius * normal; // Avoid clipping due to perspective distortion
 
     gl_Position = projection * vec4(pos, 1.0);
     fPos = pos;
     fNorm = normal;
-    fCol = vec3(1.0, 0.5, 0.5);
+    fCol = aColor.rgb;
     fCoord = coords;
     bCoord = BARYCENTRIC[vID];
     fOrigin = originPos;
+    fRadius = radius;
 }
@@ -0,0 +1,110 @@
+#version 330 core
+// Vertices of a spline mesh, one per invocation, captured with transform feedback (see SplineTessellator).
+// Same layout and math as buildSplineMesh with analytic normals: ring i holds vertices i * (loopResolution + 1) to
+// (i + 1) * (loopResolution + 1) - 1, and the last vertex of a ring repeats the first with v = 1.
+
+const int MAX_SPLINE_DEGREE = 7;
+
+uniform samplerBuffer splineData;  // Control point and orientation vector of each control point
+uniform samplerBuffer profileData; // Point and normal of each profile vertex, then its scales, per profile; then the profile of each span
+uniform samplerBuffer ringData;    // Normal of the frame and parameter t, then texture coordinate u and span, per ring
+uniform int degree;
+uniform int controlPointCount;
+uniform int loopResolution;
+uniform int spanProfileOffset;
+uniform float radius;
+uniform bool rotationMinimizingFrames;
+
+out vec3 outPosition;
+out vec3 outNormal;
+out vec2 outTexCoord;
+
+// Clamped uniform knot vector
+float knot(int i) {
+    return clamp(float(i - degree) / float(controlPointCount - degree), 0.0, 1.0);
+}
+
+vec3 controlPoint(int i) {
+    return texelFetch(splineData, 2 * i).xyz;
+}
+
+vec3 orientationVector(int i) {
+    return texelFetch(splineData, 2 * i + 1).xyz;
+}
+
+void main() {
+    int ring = gl_VertexID / (loopResolution + 1);
+    int j = gl_VertexID - ring * (loopResolution + 1);
+    vec4 ring0 = texelFetch(ringData, 2 * ring);
+    vec4 ring1 = texelFetch(ringData, 2 * ring + 1);
+    float t = ring0.w;
+    int span = int(ring1.y);
+    int knotSpan = span + degree;
+
+    // Basis functions of the span (Piegl and Tiller, algorithm A2.2), keeping those of one degree lower for the tangent
+    float N[MAX_SPLINE_DEGREE + 1];
+    float lower[MAX_SPLINE_DEGREE + 1];
+    float left[MAX_SPLINE_DEGREE + 1];
+    float right[MAX_SPLINE_DEGREE + 1];
+    N[0] = 1.0;
+    for (int d = 1; d <= degree; d++) {
+        if (d == degree) {
+            for (int k = 0; k < d; k++) lower[k] = N[k];
+        }
+        left[d] = t - knot(knotSpan + 1 - d);
+        right[d] = knot(knotSpan + d) - t;
+        float saved = 0.0;
+        for (int r = 0; r < d; r++) {
+            float temp = N[r] / (right[r + 1] + left[d - r]);
+            N[r] = saved + right[r + 1] * temp;
+            saved = left[d - r] * temp;
+        }
+        N[d] = saved;
+    }
+
+    // Position, orientation and first derivative, from the control points span to span + degree
+    vec3 center = vec3(0.0);
+    vec3 orientation = vec3(0.0);
+    for (int k = 0; k <= degree; k++) {
+        center += N[k] * controlPoint(span + k);
+        orientation += N[k] * orientationVector(span + k);
+    }
+    vec3 derivative = vec3(0.0);
+    for (int k = 0; k < degree; k++) {
+        int i = span + k;
+        derivative += lower[k] * float(degree) * (controlPoint(i + 1) - controlPoint(i)) / (knot(i + degree + 1) - knot(i + 1));
+    }
+
+    // Frame
+    vec3 tangent = normalize(derivative);
+    vec3 normal;
+    if (rotationMinimizingFrames) {
+        normal = ring0.xyz;
+    }
+    else {
+        normal = normalize(-cross(tangent, cross(tangent, orientation)));
+    }
+    vec3 binormal = normalize(cross(tangent, normal));
+
+    // Profile of the span, scaled for the position within the span
+    int profile = int(texelFetch(profileData, spanProfileOffset + span).x);
+    int base = profile * (loopResolution + 1);
+    vec4 scales = texelFetch(profileData, base + loopResolution);
+    float f = clamp(t * float(controlPointCount - degree) - float(span), 0.0, 1.0);
+    vec2 scale = radius * mix(scales.xy, scales.zw, f);
+    vec4 point = texelFetch(profileData, base + j % loopResolution);
+    outPosition = center + (point.x * scale.x * binormal + point.y * scale.y * normal);
+    outNormal = normalize(point.z * scale.y * binormal + point.w * scale.x * normal);
+
+    // Distance around the scaled profile for v
+    float dist = 0.0;
+    float totalDist = 0.0;
+    vec2 prev = texelFetch(profileData, base).xy * scale;
+    for (int k = 1; k <= loopResolution; k++) {
+        vec2 p = texelFetch(profileData, base + k % loopResolution).xy * scale;
+        totalDist += distance(prev, p);
+        if (k == j) dist = totalDist;
+        prev = p;
+    }
+    outTexCoord = vec2(ring1.x, 0.999 * dist / totalDist + 0.0005);
+}
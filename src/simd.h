@@ -0,0 +1,92 @@
+#pragma once
+
+// Minimal wrapper around SIMD registers so kernels can be written once and compiled for
+// AVX2, SSE or plain scalar code, depending on what the compiler targets.
+// Use -march=native (see ENABLE_NATIVE_ARCH in CMakeLists.txt) to get the AVX2 path.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+struct FloatV {
+    static const int WIDTH = 8;
+    __m256 v;
+
+    FloatV() {}
+    FloatV(__m256 v) : v(v) {}
+    FloatV(float s) : v(_mm256_set1_ps(s)) {}
+
+    static FloatV load(const float *p) { return _mm256_loadu_ps(p); }
+    void store(float *p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline FloatV operator+(FloatV a, FloatV b) { return _mm256_add_ps(a.v, b.v); }
+inline FloatV operator-(FloatV a, FloatV b) { return _mm256_sub_ps(a.v, b.v); }
+inline FloatV operator*(FloatV a, FloatV b) { return _mm256_mul_ps(a.v, b.v); }
+inline FloatV operator/(FloatV a, FloatV b) { return _mm256_div_ps(a.v, b.v); }
+inline FloatV sqrt(FloatV a) { return _mm256_sqrt_ps(a.v); }
+// Zero in lanes where mask is zero, a elsewhere
+inline FloatV maskNonZero(FloatV a, FloatV mask) {
+    return _mm256_and_ps(a.v, _mm256_cmp_ps(mask.v, _mm256_setzero_ps(), _CMP_NEQ_OQ));
+}
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+struct FloatV {
+    static const int WIDTH = 4;
+    __m128 v;
+
+    FloatV() {}
+    FloatV(__m128 v) : v(v) {}
+    FloatV(float s) : v(_mm_set1_ps(s)) {}
+
+    static FloatV load(const float *p) { return _mm_loadu_ps(p); }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+};
+
+inline FloatV operator+(FloatV a, FloatV b) { return _mm_add_ps(a.v, b.v); }
+inline FloatV operator-(FloatV a, FloatV b) { return _mm_sub_ps(a.v, b.v); }
+inline FloatV operator*(FloatV a, FloatV b) { return _mm_mul_ps(a.v, b.v); }
+inline FloatV operator/(FloatV a, FloatV b) { return _mm_div_ps(a.v, b.v); }
+inline FloatV sqrt(FloatV a) { return _mm_sqrt_ps(a.v); }
+inline FloatV maskNonZero(FloatV a, FloatV mask) {
+    return _mm_and_ps(a.v, _mm_cmpneq_ps(mask.v, _mm_setzero_ps()));
+}
+
+#else
+#include <cmath>
+
+// Scalar fallback
+struct FloatV {
+    static const int WIDTH = 1;
+    float v;
+
+    FloatV() {}
+    FloatV(float s) : v(s) {}
+
+    static FloatV load(const float *p) { return *p; }
+    void store(float *p) const { *p = v; }
+};
+
+inline FloatV operator+(FloatV a, FloatV b) { return a.v + b.v; }
+inline FloatV operator-(FloatV a, FloatV b) { return a.v - b.v; }
+inline FloatV operator*(FloatV a, FloatV b) { return a.v * b.v; }
+inline FloatV operator/(FloatV a, FloatV b) { return a.v / b.v; }
+inline FloatV sqrt(FloatV a) { return std::sqrt(a.v); }
+inline FloatV maskNonZero(FloatV a, FloatV mask) { return (mask.v != 0.0f) ? a.v : 0.0f; }
+
+#endif
+
+// Vector of 3 components, each holding one value per lane
+struct Vec3V {
+    FloatV x, y, z;
+};
+
+inline Vec3V operator+(Vec3V a, Vec3V b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline Vec3V operator-(Vec3V a, Vec3V b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline Vec3V operator*(FloatV s, Vec3V a) { return { s * a.x, s * a.y, s * a.z }; }
+inline FloatV dot(Vec3V a, Vec3V b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3V cross(Vec3V a, Vec3V b) {
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+inline Vec3V normalize(Vec3V a) { return (FloatV(1.0f) / sqrt(dot(a, a))) * a; }
@@ -1,4 +1,9 @@
 #include "spline.h"
+#include "simd.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 
 void BSpline::computeKnots() {
     int n = controlPoints.size();
@@ -15,93 +20,395 @@ void BSpline::computeKnots() {
     }
 }
 
-void BSpline::cacheArcLengths() {
-    // TODO Increase resolution?
-    const int CACHE_RESOLUTION = 1; // Per segment
-    int nSamples = CACHE_RESOLUTION * controlPoints.size();
+// Number of arc length cache entries per knot span
+const int ARC_LENGTH_RESOLUTION = 8;
 
-    arcLengthCache.clear();
-    arcLengthCache.reserve(nSamples + 1);
+void BSpline::cacheArcLengths(int firstInterval, int endInterval) {
+    int nSamples = ARC_LENGTH_RESOLUTION * std::max(int(controlPoints.size()) - degree, 1);
+    segmentArcLengths.resize(nSamples);
+    nodeSpeeds.resize(nSamples + 1);
 
-    arcLengthCache.push_back(0.0f);
+    // Length of each interval between cache entries, and the speed at the entries on both ends
     float dt = 1.0f / float(nSamples);
-    for (int i = 0; i < nSamples; ++i) {
+    for (int i = firstInterval; i < endInterval; ++i) {
         float t1 = float(i) * dt;
         float t2 = float(i + 1) * dt;
-        glm::vec3 p1 = evaluate(t1);
-        glm::vec3 p2 = evaluate(t2);
-        float segmentLength = glm::length(p2 - p1);
-        arcLengthCache.push_back(arcLengthCache.back() + segmentLength);
+        segmentArcLengths[i] = integrateArcLength(t1, t2);
     }
+    for (int i = firstInterval; i <= endInterval; ++i) {
+        nodeSpeeds[i] = glm::length(derivative(float(i) * dt));
+    }
+
+    // Summing up lengths is deferred until they are needed, so that multiple modifications
+    // only cause a single update
+    if (arcLengthsDirtyFrom < 0 || firstInterval < arcLengthsDirtyFrom) {
+        arcLengthsDirtyFrom = firstInterval;
+    }
+}
+
+void BSpline::updateArcLengthCaches() {
+    if (arcLengthsDirtyFrom < 0) return;
+    int first = arcLengthsDirtyFrom;
+    arcLengthsDirtyFrom = -1;
+    int nSamples = segmentArcLengths.size();
+
+    // Cumulative arc length at regular parameter intervals
+    // Entries before the first modified interval are still valid
+    arcLengthCache.resize(nSamples + 1);
+    arcLengthCache[0] = 0.0f;
+    for (int i = first; i < nSamples; ++i) {
+        arcLengthCache[i + 1] = arcLengthCache[i] + segmentArcLengths[i];
+    }
+
+    // Interval of each evenly spaced arc length, using the same resolution. Lengths before the first modified
+    // interval keep their interval, unless the total length changed, which shifts all of them.
+    // Either way this only compares cached lengths.
+    float totalLength = arcLengthCache.back();
+    int firstEntry = 0;
+    if (totalLength == lookupLength && totalLength > 0.0f) {
+        firstEntry = std::min(int(arcLengthCache[first] / totalLength * float(nSamples)), nSamples);
+    }
+    intervalLookup.resize(nSamples + 1);
+    int j = (firstEntry > 0) ? intervalLookup[firstEntry - 1] : 0;
+    for (int i = firstEntry; i <= nSamples; ++i) {
+        float targetLength = float(i) / float(nSamples) * totalLength;
+        while (j < nSamples - 1 && arcLengthCache[j + 1] < targetLength) j++;
+        intervalLookup[i] = j;
+    }
+    lookupLength = totalLength;
+}
+
+int BSpline::findInterval(float length) const {
+    int nSamples = segmentArcLengths.size();
+    float totalLength = arcLengthCache.back();
+    int i = (totalLength > 0.0f) ? std::clamp(int(length / totalLength * float(nSamples)), 0, nSamples) : 0;
+    // Intervals can be shorter than the lookup spacing, so search the intervals between the looked up one
+    // and that of the next table entry
+    int first = intervalLookup[i];
+    int last = intervalLookup[std::min(i + 1, nSamples)];
+    auto next = std::lower_bound(arcLengthCache.begin() + first + 1, arcLengthCache.begin() + last + 1, length);
+    return int(next - arcLengthCache.begin()) - 1;
+}
+
+float BSpline::intervalParameter(int interval, float length) const {
+    int nSamples = segmentArcLengths.size();
+    float dt = 1.0f / float(nSamples);
+    float t0 = float(interval) * dt;
+    float h = segmentArcLengths[interval];
+    if (h <= 0.0f) return t0;
+
+    // Cubic Hermite interpolation of t over the interval, with the inverse speeds as slopes at both ends.
+    // Slopes are limited to three times that of the chord, which keeps the cubic monotonic.
+    float w = glm::clamp((length - arcLengthCache[interval]) / h, 0.0f, 1.0f);
+    float v0 = nodeSpeeds[interval];
+    float v1 = nodeSpeeds[interval + 1];
+    float m0 = (v0 * 3.0f * dt > h) ? h / v0 : 3.0f * dt;
+    float m1 = (v1 * 3.0f * dt > h) ? h / v1 : 3.0f * dt;
+    float w2 = w * w;
+    float w3 = w2 * w;
+    float t = t0 + dt * (3.0f * w2 - 2.0f * w3) + m0 * (w3 - 2.0f * w2 + w) + m1 * (w3 - w2);
+    return glm::clamp(t, t0, t0 + dt);
+}
+
+// Rotate the normal of frame a to that of frame b, using the double reflection method
+// (Wang et al., "Computation of rotation minimizing frames", 2008)
+static glm::vec3 reflectNormal(const SplineFrame& a, const glm::vec3& position, const glm::vec3& tangent) {
+    // Reflect across the bisecting plane of the two positions
+    glm::vec3 v1 = position - a.position;
+    float c1 = glm::dot(v1, v1);
+    glm::vec3 normal = a.normal;
+    glm::vec3 reflectedTangent = a.tangent;
+    if (c1 > 1e-12f) {
+        normal -= (2.0f / c1) * glm::dot(v1, normal) * v1;
+        reflectedTangent -= (2.0f / c1) * glm::dot(v1, reflectedTangent) * v1;
+    }
+    // Reflect again so that the tangents line up
+    glm::vec3 v2 = tangent - reflectedTangent;
+    float c2 = glm::dot(v2, v2);
+    if (c2 > 1e-12f) {
+        normal -= (2.0f / c2) * glm::dot(v2, normal) * v2;
+    }
+    return normal;
+}
+
+void BSpline::updateFrameCache() {
+    int nSamples = segmentArcLengths.size();
+    int nSpans = nSamples / ARC_LENGTH_RESOLUTION;
+    if (validFrames > nSamples && validTwists > nSpans) return;
+
+    // Propagate frames on from the last valid one
+    frameCache.resize(nSamples + 1);
+    if (validFrames == 0) {
+        frameCache[0] = evaluateFrame(0.0f);
+        validFrames = 1;
+    }
+    for (int i = validFrames; i <= nSamples; i++) {
+        SplineFrame frame = evaluateFrame(float(i) / float(nSamples));
+        frame.normal = glm::normalize(reflectNormal(frameCache[i - 1], frame.position, frame.tangent));
+        frame.binormal = glm::normalize(glm::cross(frame.tangent, frame.normal));
+        frameCache[i] = frame;
+    }
+    validFrames = nSamples + 1;
+
+    // Rotation minimizing frames drift away from the orientation vectors.
+    // Measure the twist to the orientation once per knot span, it is spread out linearly in between.
+    // Orientations are treated as lines, so the frame never twists by more than 90 degrees to match one.
+    spanTwists.resize(nSpans + 1);
+    for (int k = validTwists; k <= nSpans; k++) {
+        const SplineFrame& frame = frameCache[k * ARC_LENGTH_RESOLUTION];
+        glm::vec3 target = evaluateOrientation(float(k * ARC_LENGTH_RESOLUTION) / float(nSamples));
+        float angle = std::atan2(glm::dot(glm::cross(frame.normal, target), frame.tangent), glm::dot(frame.normal, target));
+        // Choose the equivalent angle closest to the previous one to avoid sudden spins
+        float previous = (k == 0) ? 0.0f : spanTwists[k - 1];
+        angle += glm::pi<float>() * std::round((previous - angle) / glm::pi<float>());
+        spanTwists[k] = angle;
+    }
+    validTwists = nSpans + 1;
+}
+
+float BSpline::integrateArcLength(float t0, float t1) const {
+    // 5-point Gauss-Legendre nodes and weights on [-1, 1]
+    const float nodes[5] = { 0.0f, -0.5384693101f, 0.5384693101f, -0.9061798459f, 0.9061798459f };
+    const float weights[5] = { 0.5688888889f, 0.4786286705f, 0.4786286705f, 0.2369268851f, 0.2369268851f };
+
+    // Integrate speed over the interval
+    float halfWidth = 0.5f * (t1 - t0);
+    float center = 0.5f * (t0 + t1);
+    float length = 0.0f;
+    for (int i = 0; i < 5; i++) {
+        float t = center + halfWidth * nodes[i];
+        length += weights[i] * glm::length(derivative(t));
+    }
+    return length * halfWidth;
 }
 
 BSpline::BSpline(const std::vector<glm::vec3>& controlPoints,
         const std::vector<glm::vec3>& orientationVectors,
         int degree)
-    : controlPoints(controlPoints), orientationVectors(orientationVectors), degree(degree) {
+    : ownedControlPoints(controlPoints), ownedOrientationVectors(orientationVectors),
+      controlPoints{ ownedControlPoints.data(), ownedControlPoints.size() },
+      orientationVectors{ ownedOrientationVectors.data(), ownedOrientationVectors.size() },
+      degree(degree) {
     assert(orientationVectors.size() == controlPoints.size());
-    // NOTE Computation of knots and arc lengths can be done here because Spline is immutable.
-    //      If Spline is allowed to be modified after creation, they must be recomputed.
+    // NOTE Knots only depend on the number of control points, which cannot change after creation.
     computeKnots();
-    cacheArcLengths();
+    cacheArcLengths(0, ARC_LENGTH_RESOLUTION * spanCount());
 }
 
-float BSpline::basisFunction(int i, int p, float u) const {
-    if (p == 0) {
-        return (u >= knots[i] && u < knots[i + 1]) ? 1.0f : 0.0f;
+BSpline::BSpline(glm::vec3 *controlPoints, glm::vec3 *orientationVectors, int count, int degree)
+    : controlPoints{ controlPoints, size_t(count) }, orientationVectors{ orientationVectors, size_t(count) },
+      degree(degree) {
+    computeKnots();
+    cacheArcLengths(0, ARC_LENGTH_RESOLUTION * spanCount());
+}
+
+void BSpline::setControlPoint(int i, const glm::vec3& point) {
+    controlPoints[i] = point;
+    invalidate(i, i);
+}
+
+void BSpline::setControlPoint(int i, const glm::vec3& point, const glm::vec3& orientation) {
+    controlPoints[i] = point;
+    orientationVectors[i] = orientation;
+    invalidate(i, i);
+}
+
+void BSpline::setControlPoints(int first,
+        const std::vector<glm::vec3>& points,
+        const std::vector<glm::vec3>& orientations) {
+    assert(points.size() == orientations.size());
+    assert(first >= 0 && first + points.size() <= controlPoints.size());
+    if (points.empty()) return;
+    std::copy(points.begin(), points.end(), controlPoints.begin() + first);
+    std::copy(orientations.begin(), orientations.end(), orientationVectors.begin() + first);
+    invalidate(first, first + int(points.size()) - 1);
+}
+
+void BSpline::invalidate(int first, int last) {
+    int n = controlPoints.size();
+
+    // Control point i only has influence on knot spans i to i + degree
+    int firstSpan = std::max(first, degree);
+    int lastSpan = std::min(last + degree, n - 1);
+    if (firstSpan > lastSpan) return;
+
+    // Extend dirty range
+    dirtyRange.t0 = std::min(dirtyRange.t0, knots[firstSpan]);
+    dirtyRange.t1 = std::max(dirtyRange.t1, knots[lastSpan + 1]);
+
+    // Recompute lengths of the affected cache intervals
+    int firstInterval = (firstSpan - degree) * ARC_LENGTH_RESOLUTION;
+    cacheArcLengths(firstInterval, (lastSpan - degree + 1) * ARC_LENGTH_RESOLUTION);
+
+    // Frames and twists before the first affected span stay valid
+    validFrames = std::min(validFrames, firstInterval);
+    validTwists = std::min(validTwists, firstSpan - degree);
+}
+
+int BSpline::findSpan(float u) const {
+    int n = controlPoints.size();
+
+    // Interior knots are uniform, so the span can be computed directly
+    int span = degree + int(u * float(n - degree));
+    span = std::clamp(span, degree, n - 1);
+
+    // Correct for rounding differences with the stored knot values
+    while (span > degree && u < knots[span]) span--;
+    while (span < n - 1 && u >= knots[span + 1]) span++;
+
+    return span;
+}
+
+void BSpline::basisFunctions(int span, float u, BasisTable N) const {
+    assert(degree <= MAX_SPLINE_DEGREE);
+
+    // Use unrolled implementation for common degrees
+    switch (degree) {
+        case 0: BSplineT<0>::basisFunctions(knots.data(), span, u, N); return;
+        case 1: BSplineT<1>::basisFunctions(knots.data(), span, u, N); return;
+        case 2: BSplineT<2>::basisFunctions(knots.data(), span, u, N); return;
+        case 3: BSplineT<3>::basisFunctions(knots.data(), span, u, N); return;
     }
 
-    float left = 0.0f, right = 0.0f;
-    if (knots[i + p] != knots[i]) {
-        left = (u - knots[i]) / (knots[i + p] - knots[i]) *
-            basisFunction(i, p - 1, u);
+    // Build up the triangle of basis functions from degree 0 to the full degree (Cox-de Boor recursion).
+    // N[p][k] holds the basis function of control point span - p + k at degree p,
+    // functions outside of the triangle are zero.
+    N[0][0] = 1.0f;
+    for (int p = 1; p <= degree; p++) {
+        for (int k = 0; k <= p; k++) {
+            int i = span - p + k;
+            float lower = (k > 0) ? N[p - 1][k - 1] : 0.0f; // Basis function i at degree p - 1
+            float upper = (k < p) ? N[p - 1][k] : 0.0f;     // Basis function i + 1 at degree p - 1
+
+            float left = 0.0f, right = 0.0f;
+            if (knots[i + p] != knots[i]) {
+                left = (u - knots[i]) / (knots[i + p] - knots[i]) * lower;
+            }
+            if (knots[i + p + 1] != knots[i + 1]) {
+                right = (knots[i + p + 1] - u) / (knots[i + p + 1] - knots[i + 1]) * upper;
+            }
+            N[p][k] = left + right;
+        }
     }
-    if (knots[i + p + 1] != knots[i + 1]) {
-        right = (knots[i + p + 1] - u) / (knots[i + p + 1] - knots[i + 1]) *
-            basisFunction(i + 1, p - 1, u);
+}
+
+// Select the derivative order of the unrolled implementation
+template <int Degree>
+static glm::vec3 sumDerivativeT(const float *knots, const glm::vec3 *controlPoints, int span, const BasisTable N, int order) {
+    switch (order) {
+        case 0: return BSplineT<Degree>::template sumDerivative<0>(knots, controlPoints, span, N);
+        case 1: return BSplineT<Degree>::template sumDerivative<1>(knots, controlPoints, span, N);
+        default: return BSplineT<Degree>::template sumDerivative<2>(knots, controlPoints, span, N);
     }
+}
+
+glm::vec3 BSpline::sumDerivative(int span, const BasisTable N, int order) const {
+    assert(order >= 0 && order <= 2);
+
+    // Use unrolled implementation for common degrees
+    switch (degree) {
+        case 0: return sumDerivativeT<0>(knots.data(), controlPoints.data(), span, N, order);
+        case 1: return sumDerivativeT<1>(knots.data(), controlPoints.data(), span, N, order);
+        case 2: return sumDerivativeT<2>(knots.data(), controlPoints.data(), span, N, order);
+        case 3: return sumDerivativeT<3>(knots.data(), controlPoints.data(), span, N, order);
+    }
+
+    int p = degree;
+    glm::vec3 result(0.0f);
+    if (order > p) return result;
+
+    // Control points of the first derivative curve
+    auto Q = [&](int j) {
+        float d = knots[j + p + 1] - knots[j + 1];
+        if (d == 0.0f) return glm::vec3(0.0f);
+        return float(p) * (controlPoints[j + 1] - controlPoints[j]) / d;
+    };
+
+    for (int k = 0; k <= p - order; k++) {
+        int j = span - p + k;
+        glm::vec3 c;
+        if (order == 0) {
+            c = controlPoints[j];
+        }
+        else if (order == 1) {
+            c = Q(j);
+        }
+        else {
+            // Control points of the second derivative curve
+            float d = knots[j + p + 1] - knots[j + 2];
+            c = (d == 0.0f) ? glm::vec3(0.0f) : float(p - 1) * (Q(j + 1) - Q(j)) / d;
+        }
+        result += N[p - order][k] * c;
+    }
+
+    return result;
+}
 
-    return left + right;
+void BSpline::updateCaches() {
+    updateArcLengthCaches();
+    updateFrameCache();
 }
 
 float BSpline::arcLength(float t) {
+    updateArcLengthCaches();
     assert(arcLengthCache.size() > 0);
 
     // Bounds
     if (t <= 0) return 0.0f;
     if (t >= 1.0f) return arcLengthCache.back();
 
-    // Find the segment containing t
-    float index = t * float(arcLengthCache.size() - 1);
-    int i0 = int(index);
-    int i1 = std::min(i0 + 1, int(arcLengthCache.size() - 1));
-    float frac = index - float(i0);
+    // Find the cache entry before t
+    int nSamples = arcLengthCache.size() - 1;
+    int i = std::min(int(t * float(nSamples)), nSamples - 1);
 
-    // Linear interpolation between values
-    return arcLengthCache[i0] * (1.0f - frac) + arcLengthCache[i1] * frac;
+    // Add the remaining length after the cache entry
+    float tBefore = float(i) / float(nSamples);
+    return arcLengthCache[i] + integrateArcLength(tBefore, t);
 }
 
-float BSpline::parameterFromArcLength(float targetLength, float totalLength) {
-    assert(arcLengthCache.size() > 0);
+float BSpline::parameterFromArcLength(float targetLength, float totalLength, bool refine) {
+    updateArcLengthCaches();
+    assert(intervalLookup.size() > 0);
 
     // Bounds
     if (targetLength <= 0) return 0.0f;
     if (targetLength >= arcLengthCache.back()) return 1.0f;
 
-    // Binary search through the cached arc lengths
-    auto it = std::lower_bound(arcLengthCache.begin(), arcLengthCache.end(), targetLength);
-    int index = std::distance(arcLengthCache.begin(), it);
-    if (index == 0) return 0.0f;
+    // Look up the interval, and the parameter within it from the cached lengths and speeds
+    int i = findInterval(targetLength);
+    float t = intervalParameter(i, targetLength);
+
+    if (refine) {
+        // Newton step on arcLength(t) - targetLength, whose derivative is the speed
+        float speed = glm::length(derivative(t));
+        if (speed > 0.0f) {
+            int nSamples = segmentArcLengths.size();
+            t -= (arcLength(t) - targetLength) / speed;
+            t = glm::clamp(t, float(i) / float(nSamples), float(i + 1) / float(nSamples));
+        }
+    }
+
+    return t;
+}
+
+glm::vec3 BSpline::rotationMinimizingNormal(float targetLength, const glm::vec3& position, const glm::vec3& tangent) {
+    updateArcLengthCaches();
+    updateFrameCache();
 
-    // Linear interpolation between the two nearest cached values
-    float lengthBefore = arcLengthCache[index - 1];
-    float lengthAfter = arcLengthCache[index];
-    float frac = (targetLength - lengthBefore) / (lengthAfter - lengthBefore);
+    // Start from the frame cache entry before the target length
+    float length = glm::clamp(targetLength, 0.0f, arcLengthCache.back());
+    int i = findInterval(length);
+    glm::vec3 normal = reflectNormal(frameCache[i], position, tangent);
 
-    float tBefore = float(index - 1) / float(arcLengthCache.size() - 1);
-    float tAfter = float(index) / float(arcLengthCache.size() - 1);
+    // Twist, interpolated linearly over the cache entries of the knot span
+    float h = segmentArcLengths[i];
+    float x = float(i) + ((h > 0.0f) ? glm::clamp((length - arcLengthCache[i]) / h, 0.0f, 1.0f) : 0.0f);
+    int span = std::min(i / ARC_LENGTH_RESOLUTION, int(spanTwists.size()) - 2);
+    float frac = x / float(ARC_LENGTH_RESOLUTION) - float(span);
+    float angle = spanTwists[span] * (1.0f - frac) + spanTwists[span + 1] * frac;
+    normal = std::cos(angle) * normal + std::sin(angle) * glm::cross(tangent, normal);
 
-    return tBefore + frac * (tAfter - tBefore);
+    return glm::normalize(normal);
 }
 
 glm::vec3 BSpline::evaluate(float t) const {
@@ -110,57 +417,521 @@ glm::vec3 BSpline::evaluate(float t) const {
     if (t >= 1.0f) return controlPoints.back();
 
     // Add up control points weighed by their influences
-    glm::vec3 point(0.0f);
-    for (int i = 0; i < controlPoints.size(); ++i) {
-        float basis = basisFunction(i, degree, t);
-        point += basis * controlPoints[i];
+    // Only the control points of the active span have any influence
+    int span = findSpan(t);
+    BasisTable N;
+    basisFunctions(span, t, N);
+    return sumDerivative(span, N, 0);
+}
+
+glm::vec3 BSpline::evaluateOrientation(float t) const {
+    return evaluateFrame(t).normal;
+}
+
+glm::vec3 BSpline::derivative(float t) const {
+    // The end spans extend up to and including the bounds
+    t = glm::clamp(t, 0.0f, 1.0f);
+    int span = findSpan(t);
+    BasisTable N;
+    basisFunctions(span, t, N);
+    return sumDerivative(span, N, 1);
+}
+
+glm::vec3 BSpline::secondDerivative(float t) const {
+    t = glm::clamp(t, 0.0f, 1.0f);
+    int span = findSpan(t);
+    BasisTable N;
+    basisFunctions(span, t, N);
+    return sumDerivative(span, N, 2);
+}
+
+float BSpline::curvature(float t) const {
+    glm::vec3 d1 = derivative(t);
+    glm::vec3 d2 = secondDerivative(t);
+    float speed = glm::length(d1);
+    if (speed == 0.0f) return 0.0f;
+    return glm::length(glm::cross(d1, d2)) / (speed * speed * speed);
+}
+
+std::vector<float> BSpline::adaptiveSampleLengths(float maxDeviation, float radius, bool rotationMinimizingFrames, float maxSpacing) {
+    float totalLength = arcLength(1.0f);
+    float minSpacing = maxSpacing / 64.0f;
+
+    // Frame at an arc length, with the normal the mesh would use
+    auto frameAt = [&](float s) {
+        SplineFrame frame = evaluateFrame(parameterFromArcLength(s, totalLength));
+        if (rotationMinimizingFrames) {
+            frame.normal = rotationMinimizingNormal(s, frame.position, frame.tangent);
+        }
+        frame.binormal = glm::normalize(glm::cross(frame.tangent, frame.normal));
+        return frame;
+    };
+
+    // Largest step with a sagitta below maxDeviation. A point on the tube at distance radius from the axis
+    // moves along a curve of curvature k / (1 + k * radius) over a length of h * (1 + k * radius), and
+    // circles the axis with radius 'radius' at twist rate w.
+    auto stepLength = [&](float k, float w) {
+        float c = k * (1.0f + k * radius) + radius * w * w;
+        if (c <= 0.0f) return maxSpacing;
+        return glm::clamp(std::sqrt(8.0f * maxDeviation / c), minSpacing, maxSpacing);
+    };
+
+    // Largest distance between the tube at arc length s, which lies a fraction f into a step, and straight lines
+    // between the rings at both ends. The tube point at angle a is position + radius * (cos(a) * normal + sin(a) * binormal),
+    // so the distance is bounded by that of the axis plus the combined distances of both offset directions.
+    auto deviation = [&](const SplineFrame& a, const SplineFrame& b, float s, float f) {
+        SplineFrame m = frameAt(s);
+        glm::vec3 dp = m.position - glm::mix(a.position, b.position, f);
+        glm::vec3 dn = m.normal - glm::mix(a.normal, b.normal, f);
+        glm::vec3 db = m.binormal - glm::mix(a.binormal, b.binormal, f);
+        return glm::length(dp) + radius * std::sqrt(glm::dot(dn, dn) + glm::dot(db, db));
+    };
+
+    std::vector<float> lengths = { 0.0f };
+    float s0 = 0.0f;
+    SplineFrame frame0 = frameAt(0.0f);
+    float k0 = curvature(parameterFromArcLength(0.0f, totalLength));
+    float w = 0.0f;
+    while (s0 < totalLength) {
+        // Guess a step from the curvature and twist rate at the start. The twist rate of the frames is only
+        // piecewise smooth, so the guess is checked against the actual tube inside the step and shrunk if needed.
+        float h = stepLength(k0, w);
+        float s1;
+        SplineFrame frame1;
+        for (int iteration = 0; iteration < 16; iteration++) {
+            // Don't leave a short last step
+            if (s0 + 1.5f * h > totalLength) {
+                h = (s0 + h >= totalLength) ? totalLength - s0 : 0.5f * (totalLength - s0);
+            }
+            s1 = s0 + h;
+            frame1 = frameAt(s1);
+
+            float error = 0.0f;
+            for (float f : { 0.25f, 0.5f, 0.75f }) {
+                error = std::max(error, deviation(frame0, frame1, s0 + f * h, f));
+            }
+            if (error <= maxDeviation || h <= minSpacing) break;
+            // Error grows quadratically with the step
+            h = std::max(h * std::max(0.9f * std::sqrt(maxDeviation / error), 0.5f), minSpacing);
+        }
+
+        // Curvature and twist rate for the next guess
+        k0 = curvature(parameterFromArcLength(s1, totalLength));
+        glm::vec3 n1 = frame1.normal - glm::dot(frame1.normal, frame0.tangent) * frame0.tangent;
+        float angle = std::atan2(glm::dot(glm::cross(frame0.normal, n1), frame0.tangent), glm::dot(frame0.normal, n1));
+        w = (h > 0.0f) ? std::abs(angle) / h : 0.0f;
+
+        lengths.push_back(s1);
+        s0 = s1;
+        frame0 = frame1;
     }
+    if (lengths.size() < 2) lengths.push_back(0.0f);
+    lengths.back() = totalLength;
 
-    return point;
+    return lengths;
 }
 
-glm::vec3 BSpline::evaluateOrientation(float t) const {
-    // Bounds
-    if (t <= 0.0f) return orientationVectors[0];
-    if (t >= 1.0f) return orientationVectors.back();
+SplineFrame BSpline::evaluateFrame(float t) const {
+    t = glm::clamp(t, 0.0f, 1.0f);
+    int span = findSpan(t);
+    BasisTable N;
+    basisFunctions(span, t, N);
+
+    SplineFrame frame;
+    frame.position = sumDerivative(span, N, 0);
+    frame.tangent = glm::normalize(sumDerivative(span, N, 1));
 
     glm::vec3 orientation(0.0f);
-    for (int i = 0; i < controlPoints.size(); ++i) {
-        float basis = basisFunction(i, degree, t);
-        orientation += basis * orientationVectors[i];
+    for (int k = 0; k <= degree; ++k) {
+        orientation += N[degree][k] * orientationVectors[span - degree + k];
     }
 
     // Make it normal to spline
-    glm::vec3 tangent = derivative(t);
-    orientation = -glm::cross(tangent, glm::cross(tangent, orientation));
+    orientation = -glm::cross(frame.tangent, glm::cross(frame.tangent, orientation));
+    frame.normal = glm::normalize(orientation);
+    frame.binormal = glm::normalize(glm::cross(frame.tangent, frame.normal));
 
-    return glm::normalize(orientation);
+    return frame;
 }
 
-glm::vec3 BSpline::derivative(float t) const {
-    const float e = 1e-5f;
-    if (t <= e) {
-        // Forward difference at start
-        return (evaluate(t + e) - evaluate(t)) / e;
-    } else if (t >= 1.0f - e) {
-        // Backward difference at end
-        return (evaluate(t) - evaluate(t - e)) / e;
-    } else {
-        // Central difference in middle
-        return (evaluate(t + e) - evaluate(t - e)) / (2.0f * e);
+void BSpline::evaluateBatch(const float *ts, size_t n, SplineSampleBuffer &out) const {
+    out.resize(n);
+    evaluateBatch(ts, n, out, 0);
+}
+
+void BSpline::evaluateBatch(const float *ts, size_t n, SplineSampleBuffer &out, size_t outOffset) const {
+    assert(degree <= MAX_SPLINE_DEGREE);
+    assert(outOffset + n <= out.size());
+
+    // Use kernels with a fixed degree for common degrees
+    switch (degree) {
+        case 0: evaluateBatchKernel<0>(ts, n, out, outOffset); break;
+        case 1: evaluateBatchKernel<1>(ts, n, out, outOffset); break;
+        case 2: evaluateBatchKernel<2>(ts, n, out, outOffset); break;
+        case 3: evaluateBatchKernel<3>(ts, n, out, outOffset); break;
+        default: evaluateBatchKernel<-1>(ts, n, out, outOffset); break;
+    }
+}
+
+template <int Degree>
+void BSpline::evaluateBatchKernel(const float *ts, size_t n, SplineSampleBuffer &out, size_t outOffset) const {
+    const int W = FloatV::WIDTH;
+    // With a fixed degree, all loops below have constant trip counts
+    const int p = (Degree >= 0) ? Degree : degree;
+
+    // Process W samples at a time, one per SIMD lane
+    for (size_t base = 0; base < n; base += W) {
+        int count = std::min(size_t(W), n - base);
+
+        // Find span of each lane. Unused lanes repeat the last sample.
+        int spans[W];
+        float u[W];
+        for (int l = 0; l < W; l++) {
+            u[l] = glm::clamp(ts[base + std::min(l, count - 1)], 0.0f, 1.0f);
+            spans[l] = findSpan(u[l]);
+        }
+        FloatV U = FloatV::load(u);
+
+        // Gather a value for each lane into a SIMD register.
+        // With sorted input all lanes usually share a span, then a broadcast is enough.
+        bool sameSpan = std::all_of(spans, spans + W, [&](int span) { return span == spans[0]; });
+        auto gather = [&](auto f) {
+            if (sameSpan) return FloatV(f(0));
+            float lanes[W];
+            for (int l = 0; l < W; l++) {
+                lanes[l] = f(l);
+            }
+            return FloatV::load(lanes);
+        };
+
+        // Knots that affect the span, K[d] = knots[span - degree + d]
+        FloatV K[2 * MAX_SPLINE_DEGREE + 2];
+        for (int d = 0; d < 2 * p + 2; d++) {
+            K[d] = gather([&](int l) { return knots[spans[l] - p + d]; });
+        }
+
+        // Control points and orientation vectors of the span
+        Vec3V P[MAX_SPLINE_DEGREE + 1];
+        Vec3V O[MAX_SPLINE_DEGREE + 1];
+        for (int k = 0; k <= p; k++) {
+            P[k].x = gather([&](int l) { return controlPoints[spans[l] - p + k].x; });
+            P[k].y = gather([&](int l) { return controlPoints[spans[l] - p + k].y; });
+            P[k].z = gather([&](int l) { return controlPoints[spans[l] - p + k].z; });
+            O[k].x = gather([&](int l) { return orientationVectors[spans[l] - p + k].x; });
+            O[k].y = gather([&](int l) { return orientationVectors[spans[l] - p + k].y; });
+            O[k].z = gather([&](int l) { return orientationVectors[spans[l] - p + k].z; });
+        }
+
+        // Basis function triangle, same as basisFunctions()
+        FloatV N[MAX_SPLINE_DEGREE + 1][MAX_SPLINE_DEGREE + 1];
+        N[0][0] = FloatV(1.0f);
+        for (int q = 1; q <= p; q++) {
+            for (int k = 0; k <= q; k++) {
+                int i = p - q + k; // Knot span - q + k
+                FloatV left(0.0f), right(0.0f);
+                if (k > 0) {
+                    FloatV d = K[i + q] - K[i];
+                    left = maskNonZero((U - K[i]) / d * N[q - 1][k - 1], d);
+                }
+                if (k < q) {
+                    FloatV d = K[i + q + 1] - K[i + 1];
+                    right = maskNonZero((K[i + q + 1] - U) / d * N[q - 1][k], d);
+                }
+                N[q][k] = left + right;
+            }
+        }
+
+        // Position and orientation
+        Vec3V position = { 0.0f, 0.0f, 0.0f };
+        Vec3V orientation = { 0.0f, 0.0f, 0.0f };
+        for (int k = 0; k <= p; k++) {
+            position = position + N[p][k] * P[k];
+            orientation = orientation + N[p][k] * O[k];
+        }
+
+        // Derivative from the control points of the derivative curve, as in sumDerivative()
+        Vec3V tangent = { 0.0f, 0.0f, 0.0f };
+        for (int k = 0; k < p; k++) {
+            FloatV d = K[k + p + 1] - K[k + 1];
+            FloatV scale = maskNonZero(FloatV(float(p)) / d, d);
+            tangent = tangent + (N[p - 1][k] * scale) * (P[k + 1] - P[k]);
+        }
+        tangent = normalize(tangent);
+
+        // Make orientation normal to spline
+        Vec3V normal = normalize(cross(cross(tangent, orientation), tangent));
+
+        // Write results
+        size_t o = outOffset + base;
+        float *outputs[9] = {
+            &out.positionX[o], &out.positionY[o], &out.positionZ[o],
+            &out.tangentX[o], &out.tangentY[o], &out.tangentZ[o],
+            &out.normalX[o], &out.normalY[o], &out.normalZ[o],
+        };
+        FloatV values[9] = {
+            position.x, position.y, position.z,
+            tangent.x, tangent.y, tangent.z,
+            normal.x, normal.y, normal.z,
+        };
+        for (int c = 0; c < 9; c++) {
+            if (count == W) {
+                values[c].store(outputs[c]);
+            }
+            else {
+                float lanes[W];
+                values[c].store(lanes);
+                std::copy(lanes, lanes + count, outputs[c]);
+            }
+        }
+    }
+}
+
+SplinePolynomials BSpline::toPolynomials() const {
+    assert(degree <= MAX_SPLINE_DEGREE);
+    const int p = degree;
+    int n = controlPoints.size();
+    int m = n + p; // Index of last knot
+
+    SplinePolynomials result;
+    result.degree = p;
+    result.positions.reserve((n - p) * (p + 1));
+    result.orientations.reserve((n - p) * (p + 1));
+
+    // Binomial coefficients
+    float binomial[MAX_SPLINE_DEGREE + 1][MAX_SPLINE_DEGREE + 1] = {};
+    for (int i = 0; i <= p; i++) {
+        binomial[i][0] = 1.0f;
+        for (int j = 1; j <= i; j++) {
+            binomial[i][j] = binomial[i - 1][j - 1] + binomial[i - 1][j];
+        }
+    }
+
+    // Piecewise constant splines are already in the right form
+    if (p == 0) {
+        result.positions.assign(controlPoints.begin(), controlPoints.end());
+        result.orientations.assign(orientationVectors.begin(), orientationVectors.end());
+        return result;
+    }
+
+    // Same decomposition for both points and orientations
+    for (int pass = 0; pass < 2; pass++) {
+        ArrayView<glm::vec3> points = (pass == 0) ? controlPoints : orientationVectors;
+        std::vector<glm::vec3> &coefficients = (pass == 0) ? result.positions : result.orientations;
+
+        // Decompose into Bezier segments by knot insertion (The NURBS Book, algorithm A5.6).
+        // Control points of the current segment are in bezier, the next segment is started in nextBezier.
+        glm::vec3 bezier[MAX_SPLINE_DEGREE + 1];
+        glm::vec3 nextBezier[MAX_SPLINE_DEGREE + 1];
+        float alphas[MAX_SPLINE_DEGREE + 1];
+        for (int i = 0; i <= p; i++) {
+            bezier[i] = points[i];
+        }
+        int a = p;
+        int b = p + 1;
+        while (b < m) {
+            int i = b;
+            while (b < m && knots[b + 1] == knots[b]) b++;
+            int mult = b - i + 1;
+            if (mult < p) {
+                // Insert knot until its multiplicity is p
+                float numer = knots[b] - knots[a];
+                for (int j = p; j > mult; j--) {
+                    alphas[j - mult - 1] = numer / (knots[a + j] - knots[a]);
+                }
+                int r = p - mult;
+                for (int j = 1; j <= r; j++) {
+                    int save = r - j;
+                    int s = mult + j;
+                    for (int k = p; k >= s; k--) {
+                        float alpha = alphas[k - s];
+                        bezier[k] = alpha * bezier[k] + (1.0f - alpha) * bezier[k - 1];
+                    }
+                    if (b < m) nextBezier[save] = bezier[p];
+                }
+            }
+
+            // Convert finished segment from Bezier to power basis
+            for (int j = 0; j <= p; j++) {
+                glm::vec3 c(0.0f);
+                for (int i = 0; i <= j; i++) {
+                    float sign = ((j - i) % 2 == 0) ? 1.0f : -1.0f;
+                    c += sign * binomial[j][i] * bezier[i];
+                }
+                coefficients.push_back(binomial[p][j] * c);
+            }
+
+            // Start next segment
+            if (b < m) {
+                for (int i = 0; i <= p; i++) {
+                    bezier[i] = nextBezier[i];
+                }
+                for (int i = p - mult; i <= p; i++) {
+                    bezier[i] = points[b - p + i];
+                }
+                a = b;
+                b++;
+            }
+        }
+    }
+
+    return result;
+}
+
+int SplinePolynomials::findSegment(float t, float &v) const {
+    // Segments are spaced evenly in t
+    int nSegments = segmentCount();
+    float x = glm::clamp(t, 0.0f, 1.0f) * float(nSegments);
+    int segment = std::min(int(x), nSegments - 1);
+    v = x - float(segment);
+    return segment;
+}
+
+SplineFrame SplinePolynomials::evaluateFrame(float t) const {
+    float v;
+    int segment = findSegment(t, v);
+    const glm::vec3 *c = &positions[segment * (degree + 1)];
+    const glm::vec3 *o = &orientations[segment * (degree + 1)];
+
+    // Horner's method for value and derivative
+    glm::vec3 position = c[degree];
+    glm::vec3 derivative(0.0f);
+    glm::vec3 orientation = o[degree];
+    for (int k = degree - 1; k >= 0; k--) {
+        derivative = derivative * v + position;
+        position = position * v + c[k];
+        orientation = orientation * v + o[k];
+    }
+
+    SplineFrame frame;
+    frame.position = position;
+    frame.tangent = glm::normalize(derivative);
+    orientation = -glm::cross(frame.tangent, glm::cross(frame.tangent, orientation));
+    frame.normal = glm::normalize(orientation);
+    frame.binormal = glm::normalize(glm::cross(frame.tangent, frame.normal));
+    return frame;
+}
+
+ForwardDifferencer::ForwardDifferencer(const glm::vec3 *coefficients, int degree, float v0, float h)
+    : degree(degree) {
+    // Coefficients of g(x) = f(v0 + h * x), so that steps are at integer x.
+    // Shift to v0 by repeated synthetic division, then scale by powers of h.
+    glm::vec3 g[MAX_SPLINE_DEGREE + 1];
+    for (int k = 0; k <= degree; k++) {
+        g[k] = coefficients[k];
+    }
+    for (int k = 0; k < degree; k++) {
+        for (int j = degree - 1; j >= k; j--) {
+            g[j] += v0 * g[j + 1];
+        }
+    }
+    float scale = 1.0f;
+    for (int k = 0; k <= degree; k++) {
+        g[k] *= scale;
+        scale *= h;
+    }
+
+    // Forward differences at x = 0 directly from the coefficients: the k-th difference of x^i
+    // is k! * S(i, k) with S the Stirling numbers of the second kind.
+    // This avoids the cancellation of subtracting nearby function values.
+    float stirling[MAX_SPLINE_DEGREE + 1][MAX_SPLINE_DEGREE + 1] = {};
+    stirling[0][0] = 1.0f;
+    for (int i = 1; i <= degree; i++) {
+        for (int k = 1; k <= i; k++) {
+            stirling[i][k] = float(k) * stirling[i - 1][k] + stirling[i - 1][k - 1];
+        }
+    }
+    float factorial = 1.0f;
+    for (int k = 0; k <= degree; k++) {
+        if (k > 0) factorial *= float(k);
+        differences[k] = glm::vec3(0.0f);
+        for (int i = k; i <= degree; i++) {
+            differences[k] += (factorial * stirling[i][k]) * g[i];
+        }
     }
 }
 
 std::vector<glm::vec3> BSpline::generateCurve(int numPoints) const {
     std::vector<glm::vec3> curve;
     curve.reserve(numPoints);
-    for (int i = 0; i < numPoints; ++i) {
-        float t = float(i) / float(numPoints - 1);
-        curve.push_back(evaluate(t));
+    if (numPoints < 2) {
+        if (numPoints == 1) curve.push_back(evaluate(0.0f));
+        return curve;
+    }
+
+    // Step through each segment with forward differencing
+    SplinePolynomials polynomials = toPolynomials();
+    int nSegments = polynomials.segmentCount();
+    float dt = 1.0f / float(numPoints - 1);
+    int i = 0;
+    for (int segment = 0; segment < nSegments && i < numPoints; segment++) {
+        // Samples of this segment lie before the start of the next one
+        int end = (segment == nSegments - 1) ? numPoints : std::min(numPoints,
+                int(std::ceil(float(segment + 1) / float(nSegments) / dt)));
+        if (i >= end) continue;
+        float v0 = float(i) * dt * float(nSegments) - float(segment);
+        ForwardDifferencer sampler(&polynomials.positions[segment * (degree + 1)], degree, v0, dt * float(nSegments));
+        for (; i < end; i++) {
+            curve.push_back(sampler.value());
+            sampler.step();
+        }
     }
     return curve;
 }
 
+SplineSet::SplineSet(const std::vector<glm::vec3>& controlPoints,
+        const std::vector<glm::vec3>& orientationVectors,
+        const std::vector<int>& chainLengths,
+        int degree)
+    : controlPoints(controlPoints), orientationVectors(orientationVectors) {
+    assert(orientationVectors.size() == controlPoints.size());
+
+    // Offset table
+    offsets.reserve(chainLengths.size() + 1);
+    offsets.push_back(0);
+    for (int length : chainLengths) {
+        offsets.push_back(offsets.back() + length);
+    }
+    assert(offsets.back() == int(controlPoints.size()));
+
+    // Build chains on the arena
+    splines.reserve(chainLengths.size());
+    for (int c = 0; c < int(chainLengths.size()); c++) {
+        splines.emplace_back(this->controlPoints.data() + offsets[c], this->orientationVectors.data() + offsets[c],
+            chainLengths[c], degree);
+    }
+}
+
+void SplineSet::setControlPoints(int chain, int first,
+        const std::vector<glm::vec3>& points,
+        const std::vector<glm::vec3>& orientations) {
+    assert(first + offsets[chain] + int(points.size()) <= offsets[chain + 1]);
+    // Writes to the arena
+    splines[chain].setControlPoints(first, points, orientations);
+}
+
+void SplineSet::updateCaches() {
+    parallelFor(chainCount(), [&](int c) {
+        splines[c].updateCaches();
+    });
+}
+
+std::vector<float> SplineSet::arcLengths() {
+    updateCaches();
+    std::vector<float> lengths(chainCount());
+    for (int c = 0; c < chainCount(); c++) {
+        lengths[c] = splines[c].arcLength(1.0f);
+    }
+    return lengths;
+}
+
+void SplineSet::evaluateBatch(const float *ts, const std::vector<size_t>& sampleOffsets, SplineSampleBuffer &out) {
+    assert(int(sampleOffsets.size()) == chainCount() + 1);
+    out.resize(sampleOffsets.back());
+    parallelFor(chainCount(), [&](int c) {
+        size_t first = sampleOffsets[c];
+        splines[c].evaluateBatch(ts + first, sampleOffsets[c + 1] - first, out, first);
+    });
+}
 
 
 BSpline exampleSpline(bool large) {
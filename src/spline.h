@@ -2,32 +2,308 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
 #include <vector>
 
+// Highest polynomial degree supported by the span-local basis evaluation
+const int MAX_SPLINE_DEGREE = 7;
+
+// Table of basis functions for a knot span, indexed by [degree][k]
+typedef float BasisTable[MAX_SPLINE_DEGREE + 1][MAX_SPLINE_DEGREE + 1];
+
+// Basis function evaluation specialized for a fixed polynomial degree.
+// The Cox-de Boor triangle is unrolled at compile time and all loops have fixed trip counts,
+// which allows the compiler to inline and vectorize the common low degree cases.
+// BSpline dispatches to this for degrees 0 to 3 and falls back to runtime loops otherwise.
+template <int Degree>
+struct BSplineT {
+    static_assert(Degree >= 0 && Degree <= MAX_SPLINE_DEGREE, "Unsupported spline degree");
+
+    // Same as BSpline::basisFunctions, given the knot vector
+    static void basisFunctions(const float *knots, int span, float u, BasisTable N) {
+        N[0][0] = 1.0f;
+        basisLevel<1>(knots, span, u, N);
+    }
+
+    // Same as BSpline::sumDerivative, given the knot vector and control points
+    template <int Order>
+    static glm::vec3 sumDerivative(const float *knots, const glm::vec3 *controlPoints, int span, const BasisTable N) {
+        static_assert(Order >= 0 && Order <= 2, "Unsupported derivative order");
+        glm::vec3 result(0.0f);
+        if constexpr (Order <= Degree) {
+            const int p = Degree;
+            for (int k = 0; k <= p - Order; k++) {
+                int j = span - p + k;
+                glm::vec3 c;
+                if constexpr (Order == 0) {
+                    c = controlPoints[j];
+                }
+                else if constexpr (Order == 1) {
+                    c = derivativeControlPoint(knots, controlPoints, j);
+                }
+                else {
+                    float d = knots[j + p + 1] - knots[j + 2];
+                    c = (d == 0.0f) ? glm::vec3(0.0f) : float(p - 1) *
+                        (derivativeControlPoint(knots, controlPoints, j + 1) -
+                         derivativeControlPoint(knots, controlPoints, j)) / d;
+                }
+                result += N[p - Order][k] * c;
+            }
+        }
+        return result;
+    }
+
+private:
+    // Compute all basis functions of degree P, then continue with the next degree
+    template <int P>
+    static void basisLevel(const float *knots, int span, float u, BasisTable N) {
+        if constexpr (P <= Degree) {
+            basisEntry<P, 0>(knots, span, u, N);
+            basisLevel<P + 1>(knots, span, u, N);
+        }
+    }
+
+    // Compute basis function of control point span - P + K at degree P, then continue with the next one
+    template <int P, int K>
+    static void basisEntry(const float *knots, int span, float u, BasisTable N) {
+        if constexpr (K <= P) {
+            int i = span - P + K;
+            float left = 0.0f, right = 0.0f;
+            // Functions outside of the triangle are zero, so their terms are skipped
+            if constexpr (K > 0) {
+                if (knots[i + P] != knots[i]) {
+                    left = (u - knots[i]) / (knots[i + P] - knots[i]) * N[P - 1][K - 1];
+                }
+            }
+            if constexpr (K < P) {
+                if (knots[i + P + 1] != knots[i + 1]) {
+                    right = (knots[i + P + 1] - u) / (knots[i + P + 1] - knots[i + 1]) * N[P - 1][K];
+                }
+            }
+            N[P][K] = left + right;
+            basisEntry<P, K + 1>(knots, span, u, N);
+        }
+    }
+
+    // Control point j of the first derivative curve
+    static glm::vec3 derivativeControlPoint(const float *knots, const glm::vec3 *controlPoints, int j) {
+        float d = knots[j + Degree + 1] - knots[j + 1];
+        if (d == 0.0f) return glm::vec3(0.0f);
+        return float(Degree) * (controlPoints[j + 1] - controlPoints[j]) / d;
+    }
+};
+
+// Local coordinate frame of the spline at some position
+struct SplineFrame {
+    glm::vec3 position;
+    glm::vec3 tangent;  // Normalized first derivative
+    glm::vec3 normal;   // Orientation vector made normal to the spline
+    glm::vec3 binormal; // Cross product of tangent and normal
+};
+
+// Structure-of-arrays storage for a batch of spline samples.
+// Keep it around between batches to reuse the allocated memory.
+struct SplineSampleBuffer {
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> tangentX, tangentY, tangentZ;
+    std::vector<float> normalX, normalY, normalZ;
+
+    size_t size() const {
+        return positionX.size();
+    }
+    // Resize all arrays. Does not free memory when shrinking.
+    void resize(size_t n) {
+        for (std::vector<float> *v : { &positionX, &positionY, &positionZ,
+                &tangentX, &tangentY, &tangentZ,
+                &normalX, &normalY, &normalZ }) {
+            v->resize(n);
+        }
+    }
+
+    // Getters for individual samples
+    glm::vec3 position(size_t i) const {
+        return glm::vec3(positionX[i], positionY[i], positionZ[i]);
+    }
+    glm::vec3 tangent(size_t i) const {
+        return glm::vec3(tangentX[i], tangentY[i], tangentZ[i]);
+    }
+    glm::vec3 normal(size_t i) const {
+        return glm::vec3(normalX[i], normalY[i], normalZ[i]);
+    }
+};
+
+// Spline converted to one polynomial per knot span, in the power basis of a local parameter v in [0, 1].
+// Evaluating a polynomial is much cheaper than evaluating basis functions,
+// and the coefficients are a compact representation of the whole spline.
+struct SplinePolynomials {
+    int degree = 0;
+    // degree + 1 coefficients per segment, lowest power first
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> orientations;
+
+    int segmentCount() const {
+        return positions.size() / (degree + 1);
+    }
+
+    // Find the segment containing spline parameter t, and the local parameter v within that segment
+    int findSegment(float t, float &v) const;
+
+    // Evaluate position, tangent and orientation at spline parameter t, like BSpline::evaluateFrame
+    SplineFrame evaluateFrame(float t) const;
+};
+
+// Steps through a polynomial at equal parameter intervals using forward differencing,
+// which costs degree additions per step instead of a full evaluation.
+// NOTE Rounding errors accumulate with each step, so it should only be used for a limited number of steps
+class ForwardDifferencer {
+private:
+    int degree;
+    // Forward differences of increasing order at the current position
+    glm::vec3 differences[MAX_SPLINE_DEGREE + 1];
+
+public:
+    // Start at local parameter v0 of the polynomial with the given coefficients (lowest power first),
+    // advancing by h each step
+    ForwardDifferencer(const glm::vec3 *coefficients, int degree, float v0, float h);
+
+    // Value at the current position
+    glm::vec3 value() const {
+        return differences[0];
+    }
+
+    // Advance to the next position
+    void step() {
+        for (int k = 0; k < degree; k++) {
+            differences[k] += differences[k + 1];
+        }
+    }
+};
+
+// Contiguous elements stored elsewhere, e.g. the part of a SplineSet arena that belongs to one chain
+template <typename T>
+struct ArrayView {
+    T *pointer = nullptr;
+    size_t count = 0;
+
+    size_t size() const {
+        return count;
+    }
+    T *data() const {
+        return pointer;
+    }
+    T *begin() const {
+        return pointer;
+    }
+    T *end() const {
+        return pointer + count;
+    }
+    T& operator[](size_t i) const {
+        return pointer[i];
+    }
+    T& back() const {
+        return pointer[count - 1];
+    }
+};
+
+// Interval of the spline parameter, empty if t0 > t1
+struct SplineRange {
+    float t0 = 1.0f;
+    float t1 = 0.0f;
+
+    bool empty() const {
+        return t0 > t1;
+    }
+};
+
 class BSpline {
 private:
+    // Storage for the control points and orientation vectors of a standalone spline.
+    // Splines of a SplineSet leave these empty and use their part of the set's arena instead.
+    std::vector<glm::vec3> ownedControlPoints;
+    std::vector<glm::vec3> ownedOrientationVectors;
     // Control points defining the shape of the spline
-    std::vector<glm::vec3> controlPoints;
+    ArrayView<glm::vec3> controlPoints;
     // Vector corresponding to each control point, defining the orientation of the spline at that point
-    std::vector<glm::vec3> orientationVectors;
+    ArrayView<glm::vec3> orientationVectors;
     // Polynomial order of the spline (e.g. 2 for quadratic, 3 for cubic)
     int degree;
     // Knots are the points where spline segments meet
     std::vector<float> knots;
     // The arc length is the physical length of the spline in 3d space.
     // Computing it at runtime can be resource intensive, so we keep a cache of
-    // the arc length at each control point and interpolate between those.
+    // the arc length at regular intervals of t, several per knot span.
     std::vector<float> arcLengthCache;
+    // Arc length of each interval between arc length cache entries.
+    // When control points are modified only the affected intervals are recomputed.
+    std::vector<float> segmentArcLengths;
+    // Speed (length of the first derivative) at each arc length cache entry. With the interval lengths, this gives
+    // the parameter within an interval as a cubic in arc length, so inverting the arc length needs no integration.
+    std::vector<float> nodeSpeeds;
+    // Inverse of the arc length cache: the interval that contains each of a set of arc lengths spaced evenly
+    // from 0 to the total length. The interval for a given length lies between those of the two table entries
+    // around it, so it is found with a binary search over the intervals shorter than the table spacing.
+    // That is a single interval unless the spline is very unevenly parameterized.
+    std::vector<int> intervalLookup;
+    // Total length for which the interval lookup was built
+    float lookupLength = -1.0f;
+    // First interval whose cumulative length is outdated, or -1 if the caches are up to date
+    int arcLengthsDirtyFrom = -1;
+    // Parameter interval that was affected by modifications
+    SplineRange dirtyRange;
+    // Rotation minimizing frames at the arc length cache entries, i.e. at regular intervals of t, before twisting
+    // them towards the orientation vectors. Frames are propagated from the start of the spline, so modifications
+    // only invalidate the frames from the first modified knot span on.
+    std::vector<SplineFrame> frameCache;
+    int validFrames = 0;
+    // Angle by which the frames are twisted towards the orientation vectors at the start of each knot span,
+    // and at the end of the spline
+    std::vector<float> spanTwists;
+    int validTwists = 0;
 
     // Compute position of knots along the spline
     void computeKnots();
 
-    // Create arc length cache
-    void cacheArcLengths();
+    // Compute the arc lengths of the cache intervals in [firstInterval, endInterval)
+    // and mark the cumulative caches as outdated
+    void cacheArcLengths(int firstInterval, int endInterval);
+
+    // Recompute cumulative arc lengths and the interval lookup if they are outdated
+    void updateArcLengthCaches();
+
+    // Propagate rotation minimizing frames and twists past the last valid ones
+    void updateFrameCache();
+
+    // Arc length cache interval that contains the given arc length, which must be within the total length.
+    // Takes O(log k) time for the k intervals in the table cell of the length.
+    int findInterval(float length) const;
+
+    // Parameter at the given arc length within an arc length cache interval
+    float intervalParameter(int interval, float length) const;
+
+    // Update caches after control points first to last (inclusive) were modified.
+    // Only the knot spans within the local support of those control points are affected.
+    void invalidate(int first, int last);
+
+    // Integrate the length of the spline between parameters t0 and t1 with Gauss-Legendre quadrature
+    float integrateArcLength(float t0, float t1) const;
+
+    // Find the knot span containing u, i.e. the index i for which knots[i] <= u < knots[i + 1].
+    // Only control points span - degree to span have influence on the spline at u.
+    int findSpan(float u) const;
+
+    // The basis functions compute the influence of each control point at a given position along the spline.
+    // Only the basis functions that are nonzero in the given span are computed. N[p] holds the p + 1
+    // functions of degree p (up to the spline degree), so N[p][0] belongs to control point span - p.
+    void basisFunctions(int span, float u, BasisTable N) const;
 
-    // The basis function computes the influence of a control point
-    // at a given position along the spline.
-    float basisFunction(int i, int p, float u) const;
+    // Add up the derivative of the given order (0 to 2) from a basis table computed for the given span.
+    // Derivatives are taken from the derivative curves of degree - order, whose control points
+    // are differences of the original control points.
+    glm::vec3 sumDerivative(int span, const BasisTable N, int order) const;
+
+    // SIMD kernel of evaluateBatch() for a fixed degree, or the runtime degree if Degree is -1
+    template <int Degree>
+    void evaluateBatchKernel(const float *ts, size_t n, SplineSampleBuffer &out, size_t outOffset) const;
 
 public:
     // Create a B-Spline given a set of points and corresponding orientations,
@@ -36,31 +312,163 @@ public:
     BSpline(const std::vector<glm::vec3>& controlPoints,
             const std::vector<glm::vec3>& orientationVectors,
             int degree = 3);
+    // Create a B-Spline that reads and modifies count control points and orientations in external storage,
+    // which must stay in place for the lifetime of the spline
+    BSpline(glm::vec3 *controlPoints, glm::vec3 *orientationVectors, int count, int degree = 3);
+
+    // Splines can be moved, but not copied, because a copy would keep using the storage of the original
+    BSpline(const BSpline&) = delete;
+    BSpline& operator=(const BSpline&) = delete;
+    BSpline(BSpline&&) = default;
+    BSpline& operator=(BSpline&&) = default;
 
     // Getters
-    const std::vector<glm::vec3>& getControlPoints() {
-        return controlPoints;
+    ArrayView<const glm::vec3> getControlPoints() const {
+        return { controlPoints.data(), controlPoints.size() };
     }
-    const std::vector<glm::vec3>& getOrientationVectors() {
-        return orientationVectors;
+    ArrayView<const glm::vec3> getOrientationVectors() const {
+        return { orientationVectors.data(), orientationVectors.size() };
+    }
+    int getDegree() const {
+        return degree;
+    }
+
+    // Knot spans, numbered from 0 along the spline. Span i covers parameters i / spanCount() to (i + 1) / spanCount().
+    int spanCount() const {
+        return std::max(int(controlPoints.size()) - degree, 1);
     }
+    // Span that contains parameter t
+    int spanIndex(float t) const {
+        return findSpan(glm::clamp(t, 0.0f, 1.0f)) - degree;
+    }
+
+    // Modify control points. The interval lengths are only integrated again for the knot spans influenced by them,
+    // i.e. at most degree + 1 spans per control point. The remaining updates are deferred to the next query and take
+    // time linear in the number of spans after the first modified one: cumulative lengths are summed up again from
+    // there, the interval lookup is rebuilt when the total length changed, and rotation minimizing frames, which
+    // depend on the whole spline before them, are propagated again from there to the end.
+    void setControlPoint(int i, const glm::vec3& point);
+    void setControlPoint(int i, const glm::vec3& point, const glm::vec3& orientation);
+    // Replace consecutive control points and orientations, starting at index first
+    void setControlPoints(int first,
+            const std::vector<glm::vec3>& points,
+            const std::vector<glm::vec3>& orientations);
+
+    // Parameter interval affected by modifications since the last call to clearDirtyRange().
+    // Only geometry sampled at fixed parameters with frames from the orientation vectors (evaluateFrame) stays
+    // the same outside of it. Samples placed by arc length, e.g. the rings of the mesh builders, and rotation
+    // minimizing frames can change anywhere after the start of the interval.
+    SplineRange getDirtyRange() const {
+        return dirtyRange;
+    }
+    void clearDirtyRange() {
+        dirtyRange = SplineRange();
+    }
+
+    // Bring all lazily computed caches up to date.
+    // Call this before using the spline from multiple threads at once.
+    void updateCaches();
 
-    // Use cache to compute approximate arc length from 0 to t
+    // Use cache to compute arc length from 0 to t
     float arcLength(float t);
 
-    // Find parameter t that gives desired arc length
-    float parameterFromArcLength(float targetLength, float totalLength);
+    // Find parameter t that gives desired arc length using a table lookup (see intervalLookup) and the cached lengths.
+    // If refine is set, the result is improved further with a Newton step.
+    float parameterFromArcLength(float targetLength, float totalLength, bool refine = false);
 
     // Evaluate the spline at parameter t (fraction from 0 to 1)
     glm::vec3 evaluate(float t) const;
     glm::vec3 evaluateOrientation(float t) const;
 
-    // Evaluate derivative at parameter t via finite difference method
+    // Evaluate analytic first and second derivative at parameter t
     glm::vec3 derivative(float t) const;
+    glm::vec3 secondDerivative(float t) const;
+    // Curvature (inverse of the osculating circle radius) at parameter t
+    float curvature(float t) const;
+
+    // Evaluate position, tangent and orientation at parameter t at once.
+    // Cheaper than calling the separate functions because the basis functions are only computed once.
+    SplineFrame evaluateFrame(float t) const;
+
+    // Normal of the rotation minimizing frame at the given arc length, where the spline has the given position and tangent.
+    // Frames are propagated with the double reflection method along the entries of the arc length cache, and twisted
+    // gradually towards the orientation vectors. The normal at a sample only depends on the grid and on the sample
+    // itself, so samples at the same arc length get identical frames regardless of sampling density.
+    glm::vec3 rotationMinimizingNormal(float targetLength, const glm::vec3& position, const glm::vec3& tangent);
+
+    // Arc lengths at which to sample a tube of the given radius around the spline, so that straight pieces
+    // between samples deviate at most maxDeviation from the curved surface. The error bound combines the curvature
+    // of the outer side of the tube with the twist of the frames (rotation minimizing or orientation vectors).
+    // Samples are never further apart than maxSpacing. Includes both ends.
+    std::vector<float> adaptiveSampleLengths(float maxDeviation, float radius, bool rotationMinimizingFrames, float maxSpacing = 4.0f);
+
+    // Evaluate position, tangent and orientation (as in evaluateFrame) for n parameters at once.
+    // Uses SIMD across samples. Sorted parameters are fastest, because neighbouring samples then share control points.
+    void evaluateBatch(const float *ts, size_t n, SplineSampleBuffer &out) const;
+    // Same, but write into an existing buffer starting at sample outOffset, without resizing it
+    void evaluateBatch(const float *ts, size_t n, SplineSampleBuffer &out, size_t outOffset) const;
+
+    // Convert each knot span to a polynomial by inserting knots until the spline
+    // splits into Bezier segments, then changing to the power basis
+    SplinePolynomials toPolynomials() const;
 
     // Generate evenly spaced points along the curve
     std::vector<glm::vec3> generateCurve(int numPoints = 100) const;
 };
 
+// Collection of spline chains, e.g. all chains of a protein assembly.
+// Control data of all chains is kept contiguously in one arena, with an offset table marking where each chain starts.
+// The spline of each chain reads and modifies its part of the arena directly.
+// Operations on the whole set run in parallel across chains.
+class SplineSet {
+private:
+    // Control points and orientation vectors of all chains, back to back
+    std::vector<glm::vec3> controlPoints;
+    std::vector<glm::vec3> orientationVectors;
+    // Chain i owns control points offsets[i] to offsets[i + 1]
+    std::vector<int> offsets;
+    // Splines on the arena, which hold the per-chain knots and caches
+    std::vector<BSpline> splines;
+
+public:
+    // Create a set from contiguous control points and orientations, split into chains of the given lengths
+    SplineSet(const std::vector<glm::vec3>& controlPoints,
+              const std::vector<glm::vec3>& orientationVectors,
+              const std::vector<int>& chainLengths,
+              int degree = 3);
+
+    // Getters
+    int chainCount() const {
+        return splines.size();
+    }
+    BSpline& chain(int i) {
+        return splines[i];
+    }
+    const std::vector<glm::vec3>& getControlPoints() const {
+        return controlPoints;
+    }
+    const std::vector<glm::vec3>& getOrientationVectors() const {
+        return orientationVectors;
+    }
+    const std::vector<int>& getOffsets() const {
+        return offsets;
+    }
+
+    // Replace consecutive control points of a chain, starting at index first within that chain
+    void setControlPoints(int chain, int first,
+            const std::vector<glm::vec3>& points,
+            const std::vector<glm::vec3>& orientations);
+
+    // Update arc length and frame caches of all chains
+    void updateCaches();
+
+    // Total arc length of each chain
+    std::vector<float> arcLengths();
+
+    // Evaluate samples of all chains at once. Parameters of chain i are ts[sampleOffsets[i]] to
+    // ts[sampleOffsets[i + 1]], and results are written to the same positions in out.
+    void evaluateBatch(const float *ts, const std::vector<size_t>& sampleOffsets, SplineSampleBuffer &out);
+};
+
 // For testing; create a spline with hardcoded points, optionally repeated to create a bigger structure
 BSpline exampleSpline(bool large);
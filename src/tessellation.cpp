@@ -0,0 +1,166 @@
+#include "tessellation.h"
+#include <GL/glew.h>
+#include <algorithm>
+#include <cassert>
+#include "parallel.h"
+
+// Number of rings per block of work when computing ring frames in parallel
+const int TESSELLATION_BLOCK_RINGS = 64;
+
+// Upload texels into a buffer texture, creating it on first use
+static void uploadTexels(GLuint& buffer, GLuint& texture, const std::vector<glm::vec4>& texels) {
+    if (buffer == 0) {
+        glGenBuffers(1, &buffer);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(glm::vec4), texels.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+SplineTessellator::SplineTessellator(const SplineProfiles& profiles, float radius, bool rotationMinimizingFrames)
+    : splineBuffer(0), splineTexture(0), profileBuffer(0), profileTexture(0), ringBuffer(0), ringTexture(0),
+      loopResolution(profiles.getLoopResolution()), spanCount(profiles.spanCount()),
+      radius(radius), rotationMinimizingFrames(rotationMinimizingFrames) {
+    program = createTransformFeedbackProgram("../src/shaders/spline_tessellation_vertex.glsl",
+        { "outPosition", "outNormal", "outTexCoord" });
+    degreeLocation = glGetUniformLocation(program, "degree");
+    controlPointCountLocation = glGetUniformLocation(program, "controlPointCount");
+    // Attributes are not used, but core profiles need a vertex array to draw
+    glGenVertexArrays(1, &vao);
+
+    // Profiles don't change, so they are uploaded once: points and normals of each profile followed by its scales,
+    // then the profile of each span
+    std::vector<glm::vec4> texels;
+    for (int p = 0; p < profiles.profileCount(); p++) {
+        const CrossSectionProfile& profile = profiles.getProfile(p);
+        glm::vec2 maxScale = glm::max(glm::abs(profile.scaleStart), glm::abs(profile.scaleEnd));
+        for (int j = 0; j < loopResolution; j++) {
+            texels.push_back(glm::vec4(profile.points[j], profile.normals[j]));
+            maxExtent = std::max(maxExtent, radius * glm::length(profile.points[j] * maxScale));
+        }
+        texels.push_back(glm::vec4(profile.scaleStart, profile.scaleEnd));
+    }
+    spanProfileOffset = texels.size();
+    for (int span = 0; span < spanCount; span++) {
+        texels.push_back(glm::vec4(float(profiles.profileIndex(span)), 0.0f, 0.0f, 0.0f));
+    }
+    uploadTexels(profileBuffer, profileTexture, texels);
+
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "splineData"), 0);
+    glUniform1i(glGetUniformLocation(program, "profileData"), 1);
+    glUniform1i(glGetUniformLocation(program, "ringData"), 2);
+    glUniform1i(glGetUniformLocation(program, "loopResolution"), loopResolution);
+    glUniform1i(glGetUniformLocation(program, "spanProfileOffset"), spanProfileOffset);
+    glUniform1f(glGetUniformLocation(program, "radius"), radius);
+    glUniform1i(glGetUniformLocation(program, "rotationMinimizingFrames"), rotationMinimizingFrames);
+    glUseProgram(0);
+}
+
+SplineTessellator::~SplineTessellator() {
+    // Names of 0 are ignored, so buffers that were never uploaded need no check
+    GLuint buffers[3] = { splineBuffer, profileBuffer, ringBuffer };
+    GLuint textures[3] = { splineTexture, profileTexture, ringTexture };
+    glDeleteTextures(3, textures);
+    glDeleteBuffers(3, buffers);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(program);
+}
+
+void SplineTessellator::update(BSpline& spline, const std::vector<float>& targetLengths, Mesh& mesh) {
+    assert(spline.spanCount() == spanCount);
+    int rings = targetLengths.size();
+    assert(mesh.vertices.size() == splineMeshVertexCount(rings, loopResolution));
+    spline.updateCaches();
+    float totalLength = spline.arcLength(1.0f);
+
+    // Control points and orientation vectors
+    ArrayView<const glm::vec3> controlPoints = spline.getControlPoints();
+    ArrayView<const glm::vec3> orientationVectors = spline.getOrientationVectors();
+    std::vector<glm::vec4> splineTexels(2 * controlPoints.size());
+    for (size_t i = 0; i < controlPoints.size(); i++) {
+        splineTexels[2 * i] = glm::vec4(controlPoints[i], 0.0f);
+        splineTexels[2 * i + 1] = glm::vec4(orientationVectors[i], 0.0f);
+    }
+    uploadTexels(splineBuffer, splineTexture, splineTexels);
+
+    // Parameter, span and u of each ring, and the normal of its frame if that has to be propagated
+    std::vector<float> ts(rings);
+    std::vector<glm::vec4> ringTexels(2 * rings);
+    SplineSampleBuffer samples;
+    if (rotationMinimizingFrames) samples.resize(rings);
+    int nBlocks = (rings + TESSELLATION_BLOCK_RINGS - 1) / TESSELLATION_BLOCK_RINGS;
+    parallelFor(nBlocks, [&](int block) {
+        int first = block * TESSELLATION_BLOCK_RINGS;
+        int last = std::min(first + TESSELLATION_BLOCK_RINGS, rings);
+        for (int i = first; i < last; i++) {
+            ts[i] = spline.parameterFromArcLength(targetLengths[i], totalLength);
+        }
+        if (rotationMinimizingFrames) {
+            spline.evaluateBatch(&ts[first], last - first, samples, first);
+        }
+        for (int i = first; i < last; i++) {
+            glm::vec3 normal(0.0f);
+            if (rotationMinimizingFrames) {
+                normal = spline.rotationMinimizingNormal(targetLengths[i], samples.position(i), samples.tangent(i));
+            }
+            float u = 0.999f * targetLengths[i] / totalLength + 0.0005f;
+            ringTexels[2 * i] = glm::vec4(normal, ts[i]);
+            ringTexels[2 * i + 1] = glm::vec4(u, float(spline.spanIndex(ts[i])), 0.0f, 0.0f);
+        }
+    });
+    uploadTexels(ringBuffer, ringTexture, ringTexels);
+
+    // Capture the vertices into the vertex buffer of the mesh
+    if (mesh.vertexFormat != MeshVertexFormat::Full) mesh.setVertexFormat(MeshVertexFormat::Full);
+    glUseProgram(program);
+    glUniform1i(degreeLocation, spline.getDegree());
+    glUniform1i(controlPointCountLocation, controlPoints.size());
+    GLuint textures[3] = { splineTexture, profileTexture, ringTexture };
+    for (int unit = 0; unit < 3; unit++) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[unit]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindVertexArray(vao);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, mesh.vbo);
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, mesh.vertices.size());
+    glEndTransformFeedback();
+    glDisable(GL_RASTERIZER_DISCARD);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+
+    // Chunk bounds from the control points of the spans the chunk's rings lie in
+    int ringVertices = loopResolution + 1;
+    int degree = spline.getDegree();
+    for (MeshChunk& chunk : mesh.chunks) {
+        const MeshRange& range = chunk.lods[0];
+        int firstRing = range.firstVertex / ringVertices;
+        int lastRing = (range.firstVertex + range.vertexCount) / ringVertices - 1;
+        int firstPoint = spline.spanIndex(ts[firstRing]);
+        int lastPoint = spline.spanIndex(ts[lastRing]) + degree;
+        chunk.min = chunk.max = controlPoints[firstPoint];
+        for (int i = firstPoint + 1; i <= lastPoint; i++) {
+            chunk.min = glm::min(chunk.min, controlPoints[i]);
+            chunk.max = glm::max(chunk.max, controlPoints[i]);
+        }
+        chunk.min -= glm::vec3(maxExtent);
+        chunk.max += glm::vec3(maxExtent);
+    }
+}
+
+std::vector<MeshVertex> readMeshVertices(const Mesh& mesh) {
+    assert(mesh.vertexFormat == MeshVertexFormat::Full);
+    std::vector<MeshVertex> vertices(mesh.vertices.size());
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(MeshVertex), vertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return vertices;
+}
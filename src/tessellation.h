@@ -0,0 +1,44 @@
+#pragma once
+
+#include "gl.h"
+
+// Generates the vertices of a spline mesh on the GPU, straight into the vertex buffer of a Mesh, so that a mesh can follow
+// a moving spline (e.g. when playing back a trajectory) without building and uploading its vertices on the CPU.
+// Per update, only the control points and a parameter per ring (with rotation minimizing frames also its normal, since
+// frames are propagated along the spline) are uploaded. Indices, chunks and levels of detail of the mesh stay as they are.
+// The vertices are computed by a vertex shader with transform feedback and rasterization off, which works on GL 3.2,
+// and match buildSplineMesh with MeshNormals::Analytic up to float rounding.
+struct SplineTessellator {
+    GLuint program;
+    // Locations of the uniforms that change between updates, the others are set once
+    GLint degreeLocation, controlPointCountLocation;
+    GLuint vao;
+    // Buffer textures with the spline, the profiles and the rings
+    GLuint splineBuffer, splineTexture;
+    GLuint profileBuffer, profileTexture;
+    GLuint ringBuffer, ringTexture;
+    int loopResolution;
+    int spanCount;
+    // First texel of the span profiles in the profile texture
+    int spanProfileOffset;
+    float radius;
+    bool rotationMinimizingFrames;
+    // Largest distance of a vertex from the spline, over all profiles
+    float maxExtent = 0.0f;
+
+    SplineTessellator(const SplineProfiles& profiles, float radius, bool rotationMinimizingFrames);
+    // Deletes the program, vertex array, buffers and textures. They are owned, so the tessellator cannot be copied.
+    ~SplineTessellator();
+    SplineTessellator(const SplineTessellator&) = delete;
+    SplineTessellator& operator=(const SplineTessellator&) = delete;
+
+    // Regenerate the vertices of a mesh built from this spline with rings at the given arc lengths, e.g. by
+    // buildNestedSplineMeshData with the subdivided lengths. The spline may have moved since, but must keep its
+    // number of control points. The mesh switches to full vertices, and the bounds of its chunks grow to contain the
+    // control points of their spans plus the profile extent, since the curve lies in their convex hull.
+    // The CPU copy of the vertices and the errors of the levels of detail are not updated.
+    void update(BSpline& spline, const std::vector<float>& targetLengths, Mesh& mesh);
+};
+
+// Read back the vertex buffer of a mesh with full vertices, e.g. to compare GPU generated vertices with mesh.vertices
+std::vector<MeshVertex> readMeshVertices(const Mesh& mesh);
@@ -0,0 +1,98 @@
+// Tests of spline mesh building, which runs without a window or GL context.
+// Meshes are built in blocks on a thread pool, and must come out byte for byte the same for any number of threads.
+// Run through ctest, or directly; prints the failed checks and returns nonzero if there are any.
+#include "mesh.h"
+#include <cstdio>
+#include <cstring>
+
+static int failures = 0;
+
+static void check(bool condition, const char *what, const char *mode) {
+    if (condition) return;
+    std::printf("FAILED: %s (%s)\n", what, mode);
+    failures++;
+}
+
+static bool sameBytes(const MeshData& a, const MeshData& b) {
+    return a.vertices.size() == b.vertices.size() && a.indices.size() == b.indices.size() &&
+           std::memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(MeshVertex)) == 0 &&
+           std::memcmp(a.indices.data(), b.indices.data(), a.indices.size() * sizeof(unsigned int)) == 0;
+}
+
+// Large example spline with a few control points moved, so that its caches are outdated when a build starts
+static BSpline editedSpline() {
+    BSpline spline = exampleSpline(true);
+    for (int i : { 5, 40, 41, 90 }) {
+        spline.setControlPoint(i, spline.getControlPoints()[i] + glm::vec3(0.5f, -0.25f, 0.75f));
+    }
+    return spline;
+}
+
+static const char *normalModeName(MeshNormals normalMode) {
+    switch (normalMode) {
+        case MeshNormals::Averaged: return "averaged normals";
+        case MeshNormals::Analytic: return "analytic normals";
+        default: return "analytic normals with stretch";
+    }
+}
+
+// Build with each pool on a new spline, and compare with the build on the calling thread alone
+template <typename Build>
+static void testPools(const Build& build, const char *what, const char *mode) {
+    ThreadPool serial(0);
+    ThreadPool workers(7);
+    MeshData reference = build(serial);
+    check(!reference.vertices.empty() && !reference.indices.empty(), what, mode);
+    check(sameBytes(build(workers), reference), what, mode);
+    check(sameBytes(build(ThreadPool::global()), reference), what, mode);
+}
+
+int main() {
+    const int loopResolution = 16;
+    for (MeshNormals normalMode : { MeshNormals::Averaged, MeshNormals::Analytic, MeshNormals::AnalyticStretch }) {
+        for (bool rotationMinimizingFrames : { true, false }) {
+            char mode[128];
+            std::snprintf(mode, sizeof(mode), "%s, %s", normalModeName(normalMode),
+                rotationMinimizingFrames ? "rotation minimizing frames" : "orientation vectors");
+
+            testPools([&](ThreadPool& pool) {
+                BSpline spline = editedSpline();
+                SplineProfiles profiles = exampleProfiles(spline.spanCount(), loopResolution);
+                std::vector<float> lengths = addProfileSteps(spline, profiles, uniformSampleLengths(spline, 2000));
+                return buildSplineMeshData(spline, lengths, profiles, 1.0f, rotationMinimizingFrames, normalMode, pool);
+            }, "buildSplineMeshData is the same on any number of threads", mode);
+
+            // Levels and the finest level's blocks run on the pool at the same time
+            testPools([&](ThreadPool& pool) {
+                BSpline spline = editedSpline();
+                SplineProfiles profiles = exampleProfiles(spline.spanCount(), loopResolution);
+                std::vector<float> lengths = addProfileSteps(spline, profiles, uniformSampleLengths(spline, 300));
+                return buildNestedSplineMeshData(spline, lengths, profiles, 3, 1.0f, rotationMinimizingFrames, normalMode, pool);
+            }, "buildNestedSplineMeshData is the same on any number of threads", mode);
+
+            // Chains run on the pool, each with its blocks
+            testPools([&](ThreadPool& pool) {
+                BSpline example = exampleSpline(true);
+                ArrayView<const glm::vec3> points = example.getControlPoints();
+                ArrayView<const glm::vec3> orientations = example.getOrientationVectors();
+                int n = points.size();
+                SplineSet splines(std::vector<glm::vec3>(points.begin(), points.end()),
+                    std::vector<glm::vec3>(orientations.begin(), orientations.end()), { 40, 50, n - 90 });
+                std::vector<std::vector<float>> lengths;
+                std::vector<SplineProfiles> profiles;
+                for (int c = 0; c < splines.chainCount(); c++) {
+                    lengths.push_back(uniformSampleLengths(splines.chain(c), 500 + 100 * c));
+                    profiles.push_back(exampleProfiles(splines.chain(c).spanCount(), loopResolution));
+                }
+                return buildSplineMeshData(splines, lengths, profiles, 1.0f, rotationMinimizingFrames, normalMode, pool);
+            }, "buildSplineMeshData of a SplineSet is the same on any number of threads", mode);
+        }
+    }
+
+    if (failures > 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
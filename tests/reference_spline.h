@@ -0,0 +1,88 @@
+#pragma once
+
+#include "spline.h"
+
+// Reference spline with the same clamped uniform knots as BSpline::computeKnots
+struct ReferenceSpline {
+    std::vector<glm::vec3> controlPoints;
+    std::vector<glm::vec3> orientationVectors;
+    int degree;
+    std::vector<float> knots;
+
+    ReferenceSpline(const std::vector<glm::vec3>& controlPoints, const std::vector<glm::vec3>& orientationVectors, int degree)
+        : controlPoints(controlPoints), orientationVectors(orientationVectors), degree(degree) {
+        int n = controlPoints.size();
+        int m = n + degree + 1;
+        knots.resize(m);
+        for (int i = 0; i <= degree; ++i) {
+            knots[i] = 0.0f;
+        }
+        for (int i = degree + 1; i < n; ++i) {
+            knots[i] = float(i - degree) / float(n - degree);
+        }
+        for (int i = n; i < m; ++i) {
+            knots[i] = 1.0f;
+        }
+    }
+
+    // Recursive basis function of control point i at degree p, as BSpline had it before span-local evaluation.
+    // The last nonempty span is closed at the end, so that derivatives can be taken at t = 1.
+    float basisFunction(int i, int p, float u) const {
+        if (p == 0) {
+            bool lastSpan = (u == knots.back() && knots[i] < knots[i + 1] && knots[i + 1] == knots.back());
+            return ((u >= knots[i] && u < knots[i + 1]) || lastSpan) ? 1.0f : 0.0f;
+        }
+
+        float left = 0.0f, right = 0.0f;
+        if (knots[i + p] != knots[i]) {
+            left = (u - knots[i]) / (knots[i + p] - knots[i]) *
+                basisFunction(i, p - 1, u);
+        }
+        if (knots[i + p + 1] != knots[i + 1]) {
+            right = (knots[i + p + 1] - u) / (knots[i + p + 1] - knots[i + 1]) *
+                basisFunction(i + 1, p - 1, u);
+        }
+
+        return left + right;
+    }
+
+    // Old BSpline::evaluate, summing over all control points
+    glm::vec3 evaluate(float t) const {
+        if (t <= 0.0f) return controlPoints[0];
+        if (t >= 1.0f) return controlPoints.back();
+
+        glm::vec3 point(0.0f);
+        for (int i = 0; i < int(controlPoints.size()); ++i) {
+            float basis = basisFunction(i, degree, t);
+            point += basis * controlPoints[i];
+        }
+        return point;
+    }
+
+    // First derivative from the derivatives of the recursive basis functions
+    glm::vec3 derivative(float t) const {
+        int p = degree;
+        glm::vec3 result(0.0f);
+        for (int i = 0; i < int(controlPoints.size()); ++i) {
+            float d = 0.0f;
+            if (knots[i + p] != knots[i]) {
+                d += float(p) / (knots[i + p] - knots[i]) * basisFunction(i, p - 1, t);
+            }
+            if (knots[i + p + 1] != knots[i + 1]) {
+                d -= float(p) / (knots[i + p + 1] - knots[i + 1]) * basisFunction(i + 1, p - 1, t);
+            }
+            result += d * controlPoints[i];
+        }
+        return result;
+    }
+
+    // Orientation blended with the recursive basis functions, made normal to the tangent
+    glm::vec3 normal(float t) const {
+        glm::vec3 orientation(0.0f);
+        for (int i = 0; i < int(controlPoints.size()); ++i) {
+            orientation += basisFunction(i, degree, t) * orientationVectors[i];
+        }
+        glm::vec3 tangent = glm::normalize(derivative(t));
+        return glm::normalize(-glm::cross(tangent, glm::cross(tangent, orientation)));
+    }
+};
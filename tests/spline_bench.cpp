@@ -0,0 +1,156 @@
+// Microbenchmarks of spline evaluation. Built once per SIMD instruction set (see CMakeLists.txt),
+// since src/simd.h selects its path at compile time.
+#include "reference_spline.h"
+#include "simd.h"
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+// Keeps results alive so that the compiler cannot skip the work
+static volatile float sink;
+
+// Run f, which evaluates samplesPerRun samples, until at least minSeconds have passed, and return nanoseconds per sample
+static double nanosecondsPerSample(size_t samplesPerRun, const std::function<float()>& f, double minSeconds = 0.5) {
+    using Clock = std::chrono::steady_clock;
+    sink = f(); // Warm up
+    size_t runs = 0;
+    float sum = 0.0f;
+    Clock::time_point start = Clock::now();
+    double seconds = 0.0;
+    while (seconds < minSeconds) {
+        sum += f();
+        runs++;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    sink = sum;
+    return seconds * 1e9 / double(runs * samplesPerRun);
+}
+
+static void printResult(const char *name, double nanoseconds, double baseline) {
+    std::printf("  %-32s %8.2f ns/sample %8.2fx\n", name, nanoseconds, baseline / nanoseconds);
+}
+
+static const char *simdName() {
+#if defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE2__)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+// Per-sample evaluation against evaluateBatch, on sorted parameters as used for meshes
+static void benchmarkBatch(const BSpline& spline, size_t n) {
+    std::vector<float> ts(n);
+    for (size_t i = 0; i < n; i++) {
+        ts[i] = float(i) / float(n - 1);
+    }
+    SplineSampleBuffer out;
+    out.resize(n);
+
+    double perSample = nanosecondsPerSample(n, [&]() {
+        float sum = 0.0f;
+        for (size_t i = 0; i < n; i++) {
+            SplineFrame frame = spline.evaluateFrame(ts[i]);
+            out.positionX[i] = frame.position.x;
+            out.tangentX[i] = frame.tangent.x;
+            out.normalX[i] = frame.normal.x;
+            sum += frame.position.x;
+        }
+        return sum;
+    });
+    double batch = nanosecondsPerSample(n, [&]() {
+        spline.evaluateBatch(ts.data(), n, out);
+        return out.positionX[n / 2];
+    });
+
+    std::printf("Frames, %zu sorted samples, degree %d:\n", n, spline.getDegree());
+    printResult("evaluateFrame per sample", perSample, perSample);
+    printResult("evaluateBatch", batch, perSample);
+}
+
+// Span-local evaluate(), which uses BSplineT up to degree 3 and runtime loops above, against the recursive basis
+static void benchmarkDegrees(const std::vector<glm::vec3>& controlPoints, const std::vector<glm::vec3>& orientationVectors, size_t n) {
+    std::printf("Positions, %zu samples, %zu control points:\n", n, controlPoints.size());
+    for (int degree = 1; degree <= 5; degree++) {
+        BSpline spline(controlPoints, orientationVectors, degree);
+        ReferenceSpline reference(controlPoints, orientationVectors, degree);
+        double recursive = nanosecondsPerSample(n, [&]() {
+            float sum = 0.0f;
+            for (size_t i = 0; i < n; i++) {
+                sum += reference.evaluate(float(i) / float(n)).x;
+            }
+            return sum;
+        }, 0.2);
+        double spanLocal = nanosecondsPerSample(n, [&]() {
+            float sum = 0.0f;
+            for (size_t i = 0; i < n; i++) {
+                sum += spline.evaluate(float(i) / float(n)).x;
+            }
+            return sum;
+        }, 0.2);
+        std::printf(" Degree %d:\n", degree);
+        printResult("recursive basis", recursive, recursive);
+        printResult((degree <= 3) ? "evaluate (BSplineT)" : "evaluate (runtime loops)", spanLocal, recursive);
+    }
+}
+
+// Forward differencing through the polynomial segments and polynomial evaluation, against De Boor evaluation
+static void benchmarkPolynomials(const BSpline& spline, int n) {
+    SplinePolynomials polynomials = spline.toPolynomials();
+    double deBoor = nanosecondsPerSample(n, [&]() {
+        float sum = 0.0f;
+        for (int i = 0; i < n; i++) {
+            sum += spline.evaluate(float(i) / float(n - 1)).x;
+        }
+        return sum;
+    });
+    double forwardDifferencing = nanosecondsPerSample(n, [&]() {
+        return spline.generateCurve(n)[n / 2].x;
+    });
+    double conversion = nanosecondsPerSample(n, [&]() {
+        return spline.toPolynomials().positions[0].x;
+    });
+    double deBoorFrames = nanosecondsPerSample(n, [&]() {
+        float sum = 0.0f;
+        for (int i = 0; i < n; i++) {
+            sum += spline.evaluateFrame(float(i) / float(n - 1)).normal.x;
+        }
+        return sum;
+    });
+    double polynomialFrames = nanosecondsPerSample(n, [&]() {
+        float sum = 0.0f;
+        for (int i = 0; i < n; i++) {
+            sum += polynomials.evaluateFrame(float(i) / float(n - 1)).normal.x;
+        }
+        return sum;
+    });
+
+    std::printf("Polynomials, %d samples, %d segments:\n", n, polynomials.segmentCount());
+    printResult("evaluate per sample", deBoor, deBoor);
+    printResult("generateCurve", forwardDifferencing, deBoor);
+    printResult("toPolynomials alone", conversion, conversion);
+    printResult("evaluateFrame per sample", deBoorFrames, deBoorFrames);
+    printResult("SplinePolynomials::evaluateFrame", polynomialFrames, deBoorFrames);
+}
+
+int main() {
+    std::printf("SIMD path: %s, %d lanes\n\n", simdName(), FloatV::WIDTH);
+    BSpline spline = exampleSpline(true);
+    for (size_t n : { size_t(1000), size_t(100000) }) {
+        benchmarkBatch(spline, n);
+    }
+    std::printf("\n");
+
+    ArrayView<const glm::vec3> points = spline.getControlPoints();
+    ArrayView<const glm::vec3> orientations = spline.getOrientationVectors();
+    benchmarkDegrees(std::vector<glm::vec3>(points.begin(), points.end()),
+        std::vector<glm::vec3>(orientations.begin(), orientations.end()), 1000);
+    std::printf("\n");
+
+    for (int n : { 1000, 100000 }) {
+        benchmarkPolynomials(spline, n);
+    }
+    return 0;
+}
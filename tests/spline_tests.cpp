@@ -0,0 +1,326 @@
+// Regression tests for BSpline evaluation against the original recursive Cox-de Boor implementation.
+// evaluate() must match it bit for bit, as long as the compiler does not contract into fused multiply-adds.
+// Run through ctest, or directly; prints the failed checks and returns nonzero if there are any.
+#include "reference_spline.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+static int failures = 0;
+
+static void check(bool condition, const char *what, int degree, float t) {
+    if (condition) return;
+    if (failures < 20) {
+        std::printf("FAILED: %s (degree %d, t = %.9g)\n", what, degree, t);
+    }
+    failures++;
+}
+
+static bool equal(const glm::vec3& a, const glm::vec3& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static bool near(const glm::vec3& a, const glm::vec3& b, float tolerance) {
+    return glm::length(a - b) <= tolerance;
+}
+
+// Parameters to test: the ends, every knot and the floats right next to it, an even grid and random values
+static std::vector<float> testParameters(const ReferenceSpline& reference) {
+    std::vector<float> ts = { 0.0f, 1.0f };
+    for (float knot : reference.knots) {
+        ts.push_back(knot);
+        ts.push_back(std::nextafter(knot, 0.0f));
+        ts.push_back(std::nextafter(knot, 1.0f));
+    }
+    const int gridSamples = 1000;
+    for (int i = 0; i <= gridSamples; i++) {
+        ts.push_back(float(i) / float(gridSamples));
+    }
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for (int i = 0; i < 1000; i++) {
+        ts.push_back(uniform(random));
+    }
+    return ts;
+}
+
+// Samples of evaluateBatch against evaluateFrame, where the tangent is defined
+static void checkBatch(const BSpline& spline, const std::vector<float>& ts, const SplineSampleBuffer& out, size_t outOffset, float extent) {
+    const float tolerance = 1e-5f;
+    int degree = spline.getDegree();
+    for (size_t i = 0; i < ts.size(); i++) {
+        float t = ts[i];
+        SplineFrame frame = spline.evaluateFrame(t);
+        check(near(out.position(outOffset + i), frame.position, tolerance * extent), "evaluateBatch position", degree, t);
+        if (degree == 0 || glm::length(spline.derivative(t)) < 1e-3f * extent) continue;
+        check(near(out.tangent(outOffset + i), frame.tangent, tolerance), "evaluateBatch tangent", degree, t);
+        check(near(out.normal(outOffset + i), frame.normal, tolerance), "evaluateBatch normal", degree, t);
+    }
+}
+
+static void testSpline(const std::vector<glm::vec3>& controlPoints, const std::vector<glm::vec3>& orientationVectors, int degree) {
+    BSpline spline(controlPoints, orientationVectors, degree);
+    ReferenceSpline reference(controlPoints, orientationVectors, degree);
+
+    // Relative to the size of the spline
+    float extent = 0.0f;
+    for (const glm::vec3& p : controlPoints) {
+        extent = std::max(extent, glm::length(p - controlPoints[0]));
+    }
+    float tolerance = 1e-4f;
+
+    for (float t : testParameters(reference)) {
+        if (t < 0.0f || t > 1.0f) continue;
+        glm::vec3 position = reference.evaluate(t);
+        check(equal(spline.evaluate(t), position), "evaluate matches the recursive basis", degree, t);
+
+        SplineFrame frame = spline.evaluateFrame(t);
+        check(near(frame.position, position, tolerance * extent), "evaluateFrame position", degree, t);
+        if (degree == 0) continue;
+
+        // The tangent is undefined where the derivative vanishes
+        glm::vec3 derivative = reference.derivative(t);
+        if (glm::length(derivative) < 1e-3f * extent) continue;
+        check(near(spline.derivative(t), derivative, tolerance * glm::length(derivative)), "derivative", degree, t);
+        check(near(frame.tangent, glm::normalize(derivative), tolerance), "evaluateFrame tangent", degree, t);
+        check(near(frame.normal, reference.normal(t), tolerance), "evaluateFrame normal", degree, t);
+        check(std::abs(glm::dot(frame.normal, frame.tangent)) < tolerance, "frame is orthogonal", degree, t);
+    }
+
+    // The SIMD batch kernels, on sorted parameters where lanes share spans, and unsorted ones where they are gathered
+    std::vector<float> ts = testParameters(reference);
+    std::vector<float> sorted = ts;
+    std::sort(sorted.begin(), sorted.end());
+    SplineSampleBuffer out;
+    for (const std::vector<float>* parameters : { &sorted, &ts }) {
+        spline.evaluateBatch(parameters->data(), parameters->size(), out);
+        check(out.size() == parameters->size(), "evaluateBatch resizes the buffer", degree, 0.0f);
+        checkBatch(spline, *parameters, out, 0, extent);
+    }
+
+    // Writing at an offset leaves the samples around it alone. An odd count and offset leave partial SIMD blocks.
+    const size_t offset = 5;
+    const size_t count = 101;
+    const float untouched = -1234.0f;
+    out.resize(offset + count + 3);
+    for (std::vector<float> *v : { &out.positionX, &out.positionY, &out.positionZ,
+            &out.tangentX, &out.tangentY, &out.tangentZ, &out.normalX, &out.normalY, &out.normalZ }) {
+        std::fill(v->begin(), v->end(), untouched);
+    }
+    std::vector<float> part(ts.begin(), ts.begin() + count);
+    spline.evaluateBatch(part.data(), count, out, offset);
+    check(out.size() == offset + count + 3, "evaluateBatch at an offset keeps the buffer size", degree, 0.0f);
+    checkBatch(spline, part, out, offset, extent);
+    for (size_t i : { size_t(0), offset - 1, offset + count, out.size() - 1 }) {
+        check(out.positionX[i] == untouched && out.normalZ[i] == untouched, "evaluateBatch only writes its samples", degree, 0.0f);
+    }
+}
+
+// Forward differencing in generateCurve accumulates rounding errors with each step within a segment
+static void testGenerateCurve(const BSpline& spline, int numPoints, float relativeTolerance) {
+    ArrayView<const glm::vec3> points = spline.getControlPoints();
+    float extent = 0.0f;
+    for (const glm::vec3& p : points) {
+        extent = std::max(extent, glm::length(p - points[0]));
+    }
+
+    std::vector<glm::vec3> curve = spline.generateCurve(numPoints);
+    check(int(curve.size()) == numPoints, "generateCurve point count", spline.getDegree(), 0.0f);
+    float maxError = 0.0f;
+    for (int i = 0; i < int(curve.size()); i++) {
+        float t = float(i) / float(numPoints - 1);
+        float error = glm::length(curve[i] - spline.evaluate(t));
+        check(error <= relativeTolerance * extent, "generateCurve drift", spline.getDegree(), t);
+        maxError = std::max(maxError, error);
+    }
+    std::printf("generateCurve(%d): max deviation %g from evaluate(), %g of the spline extent\n",
+        numPoints, maxError, maxError / extent);
+}
+
+// Gauss-Legendre arc lengths against a dense polyline, and their inverse through the interval lookup
+static void testArcLength(const std::vector<glm::vec3>& controlPoints, const std::vector<glm::vec3>& orientationVectors, int degree) {
+    BSpline spline(controlPoints, orientationVectors, degree);
+    // Chords end at the knots, so that they follow the corners of linear splines
+    const int chords = 2000 * spline.spanCount();
+    double chordLength = 0.0;
+    glm::vec3 previous = spline.evaluate(0.0f);
+    for (int i = 1; i <= chords; i++) {
+        glm::vec3 position = spline.evaluate(float(i) / float(chords));
+        chordLength += glm::length(position - previous);
+        previous = position;
+    }
+    float totalLength = spline.arcLength(1.0f);
+    float lengthError = std::abs(float(chordLength) - totalLength) / totalLength;
+    check(lengthError <= 1e-5f, "arcLength matches a dense polyline", degree, 1.0f);
+
+    // Errors of the inverse, relative to the total length
+    float maxError = 0.0f, maxRefinedError = 0.0f;
+    const int samples = 1000;
+    for (int i = 0; i <= samples; i++) {
+        float s = float(i) / float(samples) * totalLength;
+        float error = std::abs(spline.arcLength(spline.parameterFromArcLength(s, totalLength)) - s) / totalLength;
+        float refinedError = std::abs(spline.arcLength(spline.parameterFromArcLength(s, totalLength, true)) - s) / totalLength;
+        check(error <= 2e-4f, "arcLength of parameterFromArcLength", degree, float(i) / float(samples));
+        check(refinedError <= 1e-5f, "arcLength of refined parameterFromArcLength", degree, float(i) / float(samples));
+        maxError = std::max(maxError, error);
+        maxRefinedError = std::max(maxRefinedError, refinedError);
+    }
+    std::printf("Arc length, degree %d: %g from a polyline, inverse %g, refined %g (relative)\n",
+        degree, lengthError, maxError, maxRefinedError);
+}
+
+// Edits update the caches incrementally, which must give the same results as building the spline from scratch
+static void testIncrementalUpdates(const std::vector<glm::vec3>& controlPoints, const std::vector<glm::vec3>& orientationVectors, int degree) {
+    std::vector<glm::vec3> points = controlPoints;
+    std::vector<glm::vec3> orientations = orientationVectors;
+    BSpline spline(points, orientations, degree);
+    int n = points.size();
+
+    std::mt19937 random(2);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    auto randomVector = [&]() {
+        return glm::vec3(offset(random), offset(random), offset(random));
+    };
+    for (int edit = 0; edit < 50; edit++) {
+        int first = std::uniform_int_distribution<int>(0, n - 1)(random);
+        int count = std::min(1 + edit % 3, n - first);
+        for (int i = first; i < first + count; i++) {
+            points[i] += randomVector();
+            orientations[i] = glm::normalize(orientations[i] + 0.5f * randomVector());
+        }
+        if (count == 1 && edit % 2 == 0) {
+            spline.setControlPoint(first, points[first], orientations[first]);
+        }
+        else {
+            spline.setControlPoints(first,
+                std::vector<glm::vec3>(points.begin() + first, points.begin() + first + count),
+                std::vector<glm::vec3>(orientations.begin() + first, orientations.begin() + first + count));
+        }
+        // Query now and then, so that later edits find partially valid caches
+        if (edit % 5 == 4) {
+            float length = spline.arcLength(1.0f);
+            float t = spline.parameterFromArcLength(0.5f * length, length);
+            SplineFrame frame = spline.evaluateFrame(t);
+            spline.rotationMinimizingNormal(0.5f * length, frame.position, frame.tangent);
+        }
+    }
+    spline.updateCaches();
+
+    BSpline fresh(points, orientations, degree);
+    float totalLength = fresh.arcLength(1.0f);
+    check(spline.arcLength(1.0f) == totalLength, "edited spline has the total length of a new one", degree, 1.0f);
+    const int samples = 1000;
+    for (int i = 0; i <= samples; i++) {
+        float t = float(i) / float(samples);
+        check(spline.arcLength(t) == fresh.arcLength(t), "edited spline has the arc length of a new one", degree, t);
+
+        float s = t * totalLength;
+        check(spline.parameterFromArcLength(s, totalLength) == fresh.parameterFromArcLength(s, totalLength),
+            "edited spline has the arc length inverse of a new one", degree, t);
+        float u = fresh.parameterFromArcLength(s, totalLength, true);
+        check(spline.parameterFromArcLength(s, totalLength, true) == u,
+            "edited spline has the refined arc length inverse of a new one", degree, t);
+
+        SplineFrame frame = fresh.evaluateFrame(u);
+        check(equal(spline.rotationMinimizingNormal(s, frame.position, frame.tangent),
+                    fresh.rotationMinimizingNormal(s, frame.position, frame.tangent)),
+            "edited spline has the rotation minimizing frames of a new one", degree, t);
+    }
+}
+
+// Chains of a SplineSet view the arena, so edits must reach both, also after moving the set
+static void testSplineSet(const std::vector<glm::vec3>& controlPoints, const std::vector<glm::vec3>& orientationVectors) {
+    int n = controlPoints.size();
+    std::vector<int> chainLengths = { 19, n / 3, n - 19 - n / 3 };
+    SplineSet set(controlPoints, orientationVectors, chainLengths);
+    check(set.chainCount() == 3, "SplineSet chain count", 3, 0.0f);
+
+    // Each chain matches a standalone spline of its control points
+    auto checkChains = [&](SplineSet& chains, const char *what) {
+        std::vector<float> lengths = chains.arcLengths();
+        for (int c = 0; c < chains.chainCount(); c++) {
+            auto points = chains.getControlPoints().begin() + chains.getOffsets()[c];
+            auto orientations = chains.getOrientationVectors().begin() + chains.getOffsets()[c];
+            BSpline standalone(std::vector<glm::vec3>(points, points + chainLengths[c]),
+                               std::vector<glm::vec3>(orientations, orientations + chainLengths[c]));
+            check(lengths[c] == standalone.arcLength(1.0f), what, 3, float(c));
+        }
+    };
+    checkChains(set, "SplineSet chain has the arc length of a standalone spline");
+
+    // Edits write through to the arena and the chain
+    auto edit = [&](SplineSet& chains, int c, int first, glm::vec3 shift, const char *what) {
+        std::vector<glm::vec3> points = { glm::vec3(1.0f, 2.0f, 3.0f) + shift, glm::vec3(-1.0f, 0.0f, 2.0f) + shift };
+        std::vector<glm::vec3> orientations = { glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f) };
+        chains.setControlPoints(c, first, points, orientations);
+        int offset = chains.getOffsets()[c] + first;
+        ArrayView<const glm::vec3> chainPoints = chains.chain(c).getControlPoints();
+        ArrayView<const glm::vec3> chainOrientations = chains.chain(c).getOrientationVectors();
+        for (int k = 0; k < 2; k++) {
+            check(chains.getControlPoints()[offset + k] == points[k] && chains.getOrientationVectors()[offset + k] == orientations[k],
+                what, 3, float(c));
+            check(chainPoints[first + k] == points[k] && chainOrientations[first + k] == orientations[k], what, 3, float(c));
+            check(chainPoints.data() + first + k == &chains.getControlPoints()[offset + k], what, 3, float(c));
+        }
+    };
+    edit(set, 1, 3, glm::vec3(0.0f), "SplineSet::setControlPoints writes to the arena and the chain");
+    SplineSet moved = std::move(set);
+    edit(moved, 2, 0, glm::vec3(5.0f), "SplineSet::setControlPoints after moving the set");
+    checkChains(moved, "SplineSet chain has the arc length of a standalone spline after edits");
+
+    // Batches of all chains at once match the batches of each chain
+    std::vector<size_t> sampleOffsets = { 0 };
+    std::vector<float> ts;
+    for (int c = 0; c < moved.chainCount(); c++) {
+        int samples = 50 + 17 * c;
+        for (int i = 0; i < samples; i++) {
+            ts.push_back(float(i) / float(samples - 1));
+        }
+        sampleOffsets.push_back(ts.size());
+    }
+    SplineSampleBuffer out, chainOut;
+    moved.evaluateBatch(ts.data(), sampleOffsets, out);
+    check(out.size() == ts.size(), "SplineSet::evaluateBatch sample count", 3, 0.0f);
+    for (int c = 0; c < moved.chainCount(); c++) {
+        size_t first = sampleOffsets[c];
+        moved.chain(c).evaluateBatch(ts.data() + first, sampleOffsets[c + 1] - first, chainOut);
+        for (size_t i = 0; i < chainOut.size(); i++) {
+            check(equal(out.position(first + i), chainOut.position(i)) && equal(out.tangent(first + i), chainOut.tangent(i)) &&
+                  equal(out.normal(first + i), chainOut.normal(i)), "SplineSet::evaluateBatch matches the chain", 3, ts[first + i]);
+        }
+    }
+}
+
+int main() {
+    for (bool large : { false, true }) {
+        BSpline example = exampleSpline(large);
+        ArrayView<const glm::vec3> points = example.getControlPoints();
+        ArrayView<const glm::vec3> orientations = example.getOrientationVectors();
+        std::vector<glm::vec3> controlPoints(points.begin(), points.end());
+        std::vector<glm::vec3> orientationVectors(orientations.begin(), orientations.end());
+        // Degrees 0 to 3 use BSplineT, higher ones the runtime loops
+        for (int degree = 0; degree <= 5; degree++) {
+            testSpline(controlPoints, orientationVectors, degree);
+        }
+        for (int degree : { 1, 3, 5 }) {
+            testArcLength(controlPoints, orientationVectors, degree);
+            testIncrementalUpdates(controlPoints, orientationVectors, degree);
+        }
+        if (large) {
+            testSplineSet(controlPoints, orientationVectors);
+        }
+    }
+
+    // A typical mesh resolution, and a run of over 60000 steps per segment
+    BSpline example = exampleSpline(false);
+    testGenerateCurve(example, 1000, 1e-5f);
+    testGenerateCurve(example, 1000000, 1e-3f);
+
+    if (failures > 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}